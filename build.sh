@@ -18,13 +18,23 @@ commonX64CompilerFlags="-Wl,-rpath,$PWD/externals/lib64 -L$PWD/externals/lib64 -
 echo "Building Spotter"
 
 spotterCompilerFlags="$commonCompilerFlags"
-spotterLinkerFlags="$commonLinkerFlags -lGLESv2 -ldl -lopencv_core -lopencv_calib3d -lopencv_imgproc -lopencv_features2d -lzmq"
-x64SpotterCompilerFlags="$spotterCompilerFlags $commonX64CompilerFlags -DINTERFACE=\"enp0s25\" -DCAPTURE_FRAME_WIDTH=640 -DCAPTURE_FRAME_HEIGHT=480 -DWINDOW_WIDTH=640 -DWINDOW_HEIGHT=480"
-armSpotterCompilerFlags="$spotterCompilerFlags -DINTERFACE=\"eth0\" -DCAPTURE_FRAME_WIDTH=1640 -DCAPTURE_FRAME_HEIGHT=1232 -DWINDOW_WIDTH=1640 -DWINDOW_HEIGHT=1232"
+spotterLinkerFlags="$commonLinkerFlags -lpthread -lGLESv2 -ldl -lopencv_core -lopencv_calib3d -lopencv_imgproc -lopencv_features2d -lzmq"
+# NOTE(jan): the capture size is only the default, see the -c, -f, -b and -fps options
+x64SpotterCompilerFlags="$spotterCompilerFlags $commonX64CompilerFlags -DINTERFACE=\"enp0s25\" -DCAPTURE_FRAME_WIDTH=640 -DCAPTURE_FRAME_HEIGHT=480"
+armSpotterCompilerFlags="$spotterCompilerFlags -march=armv7-a -mfpu=neon-vfpv4 -DINTERFACE=\"eth0\" -DCAPTURE_FRAME_WIDTH=1640 -DCAPTURE_FRAME_HEIGHT=1232"
 
 g++ $x64SpotterCompilerFlags -o build/x64/spotter sources/spotter/linux_spotter.cpp $spotterLinkerFlags
 arm-linux-gnueabihf-g++ --sysroot=$PWD/externals/raspberrypi/rootfs $armSpotterCompilerFlags -o build/arm/spotter sources/spotter/linux_spotter.cpp $spotterLinkerFlags
 
+# ---------------------------------------------------------------
+# Spotter Benchmark
+# ---------------------------------------------------------------
+
+echo "Building Spotter Benchmark"
+
+g++ $x64SpotterCompilerFlags -o build/x64/spotterBenchmark sources/spotter/linux_spotterBenchmark.cpp $spotterLinkerFlags
+arm-linux-gnueabihf-g++ --sysroot=$PWD/externals/raspberrypi/rootfs $armSpotterCompilerFlags -o build/arm/spotterBenchmark sources/spotter/linux_spotterBenchmark.cpp $spotterLinkerFlags
+
 # ---------------------------------------------------------------
 # Spotter Calibration
 # ---------------------------------------------------------------
@@ -32,7 +42,7 @@ arm-linux-gnueabihf-g++ --sysroot=$PWD/externals/raspberrypi/rootfs $armSpotterC
 echo "Building Spotter Calibration"
 
 spotterCalibCompilerFlags="$commonCompilerFlags"
-spotterCalibLinkerFlags="$commonLinkerFlags -lGLESv2 -ldl -lglfw -lopencv_core -lopencv_calib3d -lopencv_imgproc -lopencv_features2d"
+spotterCalibLinkerFlags="$commonLinkerFlags -lpthread -lGLESv2 -ldl -lglfw -lopencv_core -lopencv_calib3d -lopencv_imgproc -lopencv_features2d"
 x64SpotterCalibCompilerFlags="$spotterCalibCompilerFlags  $commonX64CompilerFlags -DINTERFACE=\"enp0s25\" -DCAPTURE_FRAME_WIDTH=640 -DCAPTURE_FRAME_HEIGHT=480 -DWINDOW_WIDTH=320 -DWINDOW_HEIGHT=240"
 armSpotterCalibCompilerFlags="$spotterCalibCompilerFlags -DINTERFACE=\"eth0\" -DCAPTURE_FRAME_WIDTH=1640 -DCAPTURE_FRAME_HEIGHT=1232 -DWINDOW_WIDTH=410 -DWINDOW_HEIGHT=308"
 
@@ -46,7 +56,10 @@ arm-linux-gnueabihf-g++ --sysroot=$PWD/externals/raspberrypi/rootfs $armSpotterC
 echo "Building Beholder"
 
 beholderCompilerFlags="$commonCompilerFlags $commonX64CompilerFlags"
-beholderLinkerFlags="$commongLinkerFlags -lpthread -lzmq"
+beholderLinkerFlags="$commongLinkerFlags -lpthread -lrt -lzmq"
 
 g++ $beholderCompilerFlags -o build/x64/beholder sources/beholder/linux_beholder.cpp $beholderLinkerFlags
 
+# NOTE(jan): only depends on rigbuffer.h, like any outside consumer
+g++ $commonCompilerFlags -o build/x64/rigReader sources/beholder/linux_rigReader.cpp -lrt
+
@@ -1,5 +1,125 @@
 #include "b_datahandler.h"
 
+static void sendMarkerPrediction(MemoryArena* arena,
+                                 TransmissionState* spotterSenderTransmissionState,
+                                 MarkerPrediction* markerPrediction)
+{
+    u32 payloadSize = sizeof(CommandType) + sizeof(MarkerPrediction);
+    u8* payload = (u8*)pushSize(arena, payloadSize);
+    *((CommandType*)payload) = CommandType_MarkerPrediction;
+    memcpy(payload + sizeof(CommandType),
+           markerPrediction,
+           sizeof(MarkerPrediction));
+    
+    sendMessage(arena,
+                spotterSenderTransmissionState,
+                MessageType_Command,
+                payload,
+                payloadSize,
+                0);
+}
+
+// NOTE(jan): 0 for rays that are not worth triangulating
+static r32 getRayWeight(RayQuality* quality)
+{
+    r32 uncertainty = RAY_DEFAULT_CENTROID_UNCERTAINTY_PX;
+    if (quality)
+    {
+        if (quality->circularity < (u8)(RAY_MIN_CIRCULARITY * 255.0f) ||
+            quality->centroidUncertainty > RAY_MAX_CENTROID_UNCERTAINTY_PX)
+        {
+            return 0.0f;
+        }
+        
+        uncertainty = quality->centroidUncertainty;
+        if (uncertainty < RAY_MIN_CENTROID_UNCERTAINTY_PX)
+        {
+            uncertainty = RAY_MIN_CENTROID_UNCERTAINTY_PX;
+        }
+    }
+    
+    r32 result = 1.0f / (uncertainty * uncertainty);
+    
+    return result;
+}
+
+// NOTE(jan): insertion sort, buckets hold at most 100 rays
+static void sortBucketByWeight(Bucket* bucket)
+{
+    for (i32 i = 1; i < bucket->used; i++)
+    {
+        Ray ray = bucket->rays[i];
+        r32 weight = bucket->weights[i];
+        
+        i32 j = i - 1;
+        while (j >= 0 && bucket->weights[j] < weight)
+        {
+            bucket->rays[j + 1] = bucket->rays[j];
+            bucket->weights[j + 1] = bucket->weights[j];
+            j--;
+        }
+        
+        bucket->rays[j + 1] = ray;
+        bucket->weights[j + 1] = weight;
+    }
+}
+
+// NOTE(jan): counts the frames the spotter dropped since its last payload
+// and returns the exposure of this one on the beholder clock
+static u64 updateSpotterFrameTiming(SpotterFrameTiming* timing,
+                                    PayloadHeader* header,
+                                    u64 receivedTimestampUs)
+{
+    if (timing->hasSequence &&
+        header->frameSequence > timing->lastSequence)
+    {
+        timing->droppedFrameCount +=
+            header->frameSequence - timing->lastSequence - 1;
+    }
+    // NOTE(jan): anything else means the capture restarted
+    timing->hasSequence = 1;
+    timing->lastSequence = header->frameSequence;
+    timing->receivedFrameCount++;
+    timing->binarizationThreshold = header->binarizationThreshold;
+    
+    i64 offsetUs = (i64)receivedTimestampUs - (i64)header->sentTimestampUs;
+    if (timing->offsetSampleCount % FRAME_TIMING_OFFSET_WINDOW == 0 ||
+        offsetUs < timing->windowMinOffsetUs)
+    {
+        timing->windowMinOffsetUs = offsetUs;
+    }
+    timing->offsetSampleCount++;
+    
+    if (timing->offsetSampleCount <= FRAME_TIMING_OFFSET_WINDOW ||
+        timing->offsetSampleCount % FRAME_TIMING_OFFSET_WINDOW == 0 ||
+        offsetUs < timing->clockOffsetUs)
+    {
+        timing->clockOffsetUs = timing->windowMinOffsetUs;
+    }
+    
+    u64 result = (u64)((i64)header->exposureTimestampUs + timing->clockOffsetUs);
+    
+    return result;
+}
+
+static void printSpotterFrameTimings(RayBuckets* rayBuckets,
+                                     i32 clientCount)
+{
+    for (i32 i = 0; i < clientCount; i++)
+    {
+        SpotterFrameTiming* timing = &rayBuckets->spotterTimings[i];
+        printf("Spotter %i: %" PRIu64 " frames received, %" PRIu64 " dropped, "
+               "threshold %u\n",
+               i + 1,
+               timing->receivedFrameCount,
+               timing->droppedFrameCount,
+               timing->binarizationThreshold);
+    }
+    printf("%" PRIu64 " frame sets with exposures more than %i ms apart\n",
+           rayBuckets->_mismatchedFrameSetCount,
+           FRAME_SET_MAX_SPREAD_US / 1000);
+}
+
 static void messageHandler(MemoryArena* listenerArena, 
                            TransmissionState* spotterReceiverTransmissionState, 
                            TransmissionState* spotterSenderTransmissionState,
@@ -9,6 +129,7 @@ static void messageHandler(MemoryArena* listenerArena,
                            bool32* _saveRaysToFile,
                            bool32* _matchModel,
                            DebugStatus* _debugStatus,
+                           MarkerPrediction* _markerPrediction,
                            ApplicationState* _applicationState)
 {
     Message msg = {};
@@ -24,6 +145,9 @@ static void messageHandler(MemoryArena* listenerArena,
     initMemoryArena(&flushListenerArena, flushListenerMemorySize, 
                     (listenerArena->base + permanentListenerMemorySize));
     
+    u64 timeOfLastTimingStats = getWallclockTimeInMs();
+    u64 lastDroppedFrameCount = 0;
+    
     while(_applicationState->status != ApplicationStatus_Exiting)
     {
         while (receiveMessageNonBlocking(&flushListenerArena,
@@ -34,38 +158,116 @@ static void messageHandler(MemoryArena* listenerArena,
             {
                 case MessageType_Payload:
                 {
-                    if (msg.data)
+                    u8 clientID = msg.header.spotterID;
+                    if (msg.data &&
+                        msg.header.payloadSize >= sizeof(PayloadHeader) &&
+                        clientID >= 1 && clientID <= CAMERA_COUNT)
                     {
-                        u8 clientID = msg.header.spotterID;
-                        u32 rayCount = msg.header.payloadSize/sizeof(Ray);
-                        u8* data = (u8*)msg.data;
+                        u64 receivedTimestampUs = getMonotonicTimeInUs();
+                        
+                        PayloadHeader* payloadHeader = (PayloadHeader*)msg.data;
+                        u32 rayCount = (msg.header.payloadSize - sizeof(PayloadHeader)) / sizeof(Ray);
+                        if (payloadHeader->rayCount < rayCount)
+                        {
+                            rayCount = payloadHeader->rayCount;
+                        }
+                        u8* data = (u8*)msg.data + sizeof(PayloadHeader);
+                        
+                        RayQuality* qualities = 0;
+                        if (msg.header.payloadSize >=
+                            sizeof(PayloadHeader) + rayCount * (sizeof(Ray) + sizeof(RayQuality)))
+                        {
+                            qualities = (RayQuality*)(data + rayCount * sizeof(Ray));
+                        }
+                        
+                        u64 exposureTimestampUs = 
+                            updateSpotterFrameTiming(&rayBuckets->spotterTimings[clientID - 1],
+                                                     payloadHeader,
+                                                     receivedTimestampUs);
                         
                         i32 backIndex = rayBuckets->backIndex;
                         Bucket* bucket = &rayBuckets->buckets[backIndex][clientID - 1];
                         bucket->used = 0;
                         
-                        for(u32 i = 0; i < rayCount && i < 100; i++) 
+                        for(u32 i = 0; i < rayCount && bucket->used < 100; i++) 
                         {
-                            bucket->rays[i] = *((Ray*)data);
+                            r32 weight = getRayWeight(qualities ? &qualities[i] : 0);
+                            if (weight > 0.0f)
+                            {
+                                bucket->rays[bucket->used] = *((Ray*)data);
+                                bucket->weights[bucket->used] = weight;
+                                bucket->used++;
+                            }
                             data += sizeof(Ray);
-                            bucket->used++;
+                        }
+                        sortBucketByWeight(bucket);
+                        
+                        // NOTE(jan): a spotter that answers twice before the
+                        // others answered once only replaces its own rays
+                        u32 clientBit = 1 << (clientID - 1);
+                        if (!(rayBuckets->updatedClientsMask & clientBit))
+                        {
+                            rayBuckets->updatedClientsMask |= clientBit;
+                            rayBuckets->updatedClientsCount++;
+                        }
+                        
+                        if (rayBuckets->updatedClientsCount == 1 ||
+                            exposureTimestampUs < rayBuckets->setMinExposureUs)
+                        {
+                            rayBuckets->setMinExposureUs = exposureTimestampUs;
+                        }
+                        if (rayBuckets->updatedClientsCount == 1 ||
+                            exposureTimestampUs > rayBuckets->setMaxExposureUs)
+                        {
+                            rayBuckets->setMaxExposureUs = exposureTimestampUs;
                         }
                         
-                        rayBuckets->updatedClientsCount++;
                         bool32 grabFrameCommandCanBeSent =
                             rayBuckets->updatedClientsCount >= rayBuckets->clientCount;
                         
                         if (grabFrameCommandCanBeSent)
                         {
+                            FrameSetTiming* frameSetTiming = 
+                                &rayBuckets->frameSetTimings[backIndex];
+                            frameSetTiming->exposureTimestampUs = rayBuckets->setMinExposureUs;
+                            frameSetTiming->exposureSpreadUs =
+                                rayBuckets->setMaxExposureUs - rayBuckets->setMinExposureUs;
+                            frameSetTiming->completedTimestampUs = receivedTimestampUs;
+                            
+                            u64 droppedFrameCount = 0;
+                            for (i32 i = 0; i < CAMERA_COUNT; i++)
+                            {
+                                droppedFrameCount += rayBuckets->spotterTimings[i].droppedFrameCount;
+                            }
+                            
                             global_bucketMutex.lock();
                             rayBuckets->_allBucketsUpdatedSinceGet = 1;
                             rayBuckets->_frontIndex = backIndex;
+                            rayBuckets->_droppedFrameCount = droppedFrameCount;
+                            if (frameSetTiming->exposureSpreadUs > FRAME_SET_MAX_SPREAD_US)
+                            {
+                                rayBuckets->_mismatchedFrameSetCount++;
+                            }
                             global_bucketMutex.unlock();
                             
                             rayBuckets->backIndex = (backIndex + 1) % RAY_BUCKET_COUNT;
                             rayBuckets->updatedClientsCount = 0;
+                            rayBuckets->updatedClientsMask = 0;
                             rayBuckets->clientCount = clientList->clientCount;
                             
+                            // NOTE(jan): the spotters need the regions of
+                            // interest before they grab the next frame
+                            global_markerPredictionMutex.lock();
+                            MarkerPrediction markerPrediction = *_markerPrediction;
+                            global_markerPredictionMutex.unlock();
+                            
+                            if (markerPrediction.markerCount)
+                            {
+                                sendMarkerPrediction(&flushListenerArena,
+                                                     spotterSenderTransmissionState,
+                                                     &markerPrediction);
+                            }
+                            
                             CommandType commandType = CommandType_GrabFrame;
                             sendMessage(&flushListenerArena,
                                         spotterSenderTransmissionState,
@@ -233,13 +435,32 @@ static void messageHandler(MemoryArena* listenerArena,
             }
         }
         
+        u64 now = getWallclockTimeInMs();
+        if (now > timeOfLastTimingStats + FRAME_TIMING_STATS_INTERVAL_MS)
+        {
+            global_bucketMutex.lock();
+            u64 droppedFrameCount = rayBuckets->_droppedFrameCount;
+            global_bucketMutex.unlock();
+            
+            if (droppedFrameCount != lastDroppedFrameCount)
+            {
+                printSpotterFrameTimings(rayBuckets, clientList->clientCount);
+                lastDroppedFrameCount = droppedFrameCount;
+            }
+            
+            timeOfLastTimingStats = now;
+        }
+        
         flushMemory(&flushListenerArena);
     }
+    
+    printSpotterFrameTimings(rayBuckets, clientList->clientCount);
 }
 
 static bool32 getBucketsIfAllUpdated(RayBuckets* src, 
                                      Bucket* dest, 
-                                     i32 bucketCount)
+                                     i32 bucketCount,
+                                     FrameSetTiming* frameSetTiming)
 {
     bool32 result = 0;
     
@@ -250,6 +471,7 @@ static bool32 getBucketsIfAllUpdated(RayBuckets* src,
         memcpy(dest, 
                src->buckets[src->_frontIndex],
                bucketCount * sizeof(Bucket));
+        *frameSetTiming = src->frameSetTimings[src->_frontIndex];
         src->_allBucketsUpdatedSinceGet = 0;
     }
     global_bucketMutex.unlock();
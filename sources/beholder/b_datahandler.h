@@ -3,6 +3,7 @@
 std::mutex global_bucketMutex;
 std::mutex global_debugInfoMutex;
 std::mutex global_flagMutex;
+std::mutex global_markerPredictionMutex;
 
 #define DATAHANDLER_H
 #endif
\ No newline at end of file
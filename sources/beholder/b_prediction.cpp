@@ -0,0 +1,284 @@
+#include "b_prediction.h"
+
+static void resetRigMotionModel(RigMotionModel* model,
+                                V3* points,
+                                u64 timestampUs)
+{
+    for (i32 i = 0; i < HUMANOID_RIG_POINT_COUNT; i++)
+    {
+        model->joints[i].position = points[i];
+        model->joints[i].velocity = {};
+    }
+    
+    model->timestampUs = timestampUs;
+    model->observationCount = 1;
+    model->isValid = 1;
+    model->predictionErrorRms = 0.0f;
+}
+
+// NOTE(jan): has to be called with global_motionModelMutex held
+static void updateRigMotionModel(RigMotionModel* model,
+                                 V3* points,
+                                 u64 timestampUs)
+{
+    r32 dTMs = (r32)((i64)(timestampUs - model->timestampUs)) / 1000.0f;
+    
+    if (!model->isValid ||
+        dTMs <= 0.0f ||
+        dTMs > PREDICTION_RESET_INTERVAL_MS)
+    {
+        resetRigMotionModel(model, points, timestampUs);
+        return;
+    }
+    
+    r32 dT = dTMs / 1000.0f;
+    r32 squaredErrorSum = 0.0f;
+    
+    for (i32 i = 0; i < HUMANOID_RIG_POINT_COUNT; i++)
+    {
+        JointMotion* joint = &model->joints[i];
+        
+        V3 predicted = addV3(joint->position,
+                             multV3R(joint->velocity, dT));
+        V3 residual = subV3(points[i], predicted);
+        squaredErrorSum += lengthSqV3(residual);
+        
+        joint->position = addV3(predicted,
+                                multV3R(residual, PREDICTION_ALPHA));
+        joint->velocity = addV3(joint->velocity,
+                                multV3R(residual, PREDICTION_BETA / dT));
+    }
+    
+    // NOTE(jan): the first residual after a reset is made without any
+    // velocity, it would only spoil the error measurement
+    r32 errorRms = sqrt(squaredErrorSum / HUMANOID_RIG_POINT_COUNT);
+    if (model->observationCount == 2)
+    {
+        model->predictionErrorRms = errorRms;
+    }
+    else if (model->observationCount > 2)
+    {
+        model->predictionErrorRms +=
+            PREDICTION_ERROR_SMOOTHING * (errorRms - model->predictionErrorRms);
+    }
+    
+    model->observationIntervalUs = timestampUs - model->timestampUs;
+    model->timestampUs = timestampUs;
+    model->observationCount++;
+}
+
+// NOTE(jan): has to be called with global_motionModelMutex held
+static bool32 predictRig(RigMotionModel* model,
+                         u64 targetTimestampUs,
+                         RigPrediction* prediction)
+{
+    if (!model->isValid)
+    {
+        return 0;
+    }
+    
+    r32 horizonMs =
+        (r32)((i64)(targetTimestampUs - model->timestampUs)) / 1000.0f;
+    if (horizonMs < 0.0f)
+    {
+        horizonMs = 0.0f;
+    }
+    else if (horizonMs > PREDICTION_MAX_HORIZON_MS)
+    {
+        horizonMs = PREDICTION_MAX_HORIZON_MS;
+    }
+    r32 horizon = horizonMs / 1000.0f;
+    
+    prediction->observationTimestampUs = model->timestampUs;
+    prediction->targetTimestampUs = targetTimestampUs;
+    prediction->horizonMs = horizonMs;
+    prediction->predictionErrorRms = model->predictionErrorRms;
+    
+    for (i32 i = 0; i < HUMANOID_RIG_POINT_COUNT; i++)
+    {
+        JointMotion* joint = &model->joints[i];
+        prediction->points[i] = addV3(joint->position,
+                                      multV3R(joint->velocity, horizon));
+    }
+    
+    return 1;
+}
+
+// NOTE(jan): where the markers will be when the spotters take their next
+// frame. The grab command for it goes out as soon as the rays of the
+// current frame are in, before that frame is tracked, so the prediction
+// has to reach two observation intervals past the last tracked frame.
+static MarkerPrediction predictMarkers(RigMotionModel* motionModel)
+{
+    MarkerPrediction result = {};
+    RigPrediction prediction = {};
+    
+    global_motionModelMutex.lock();
+    bool32 predicted = 
+        predictRig(motionModel,
+                   motionModel->timestampUs +
+                   MARKER_PREDICTION_FRAME_LEAD * motionModel->observationIntervalUs,
+                   &prediction);
+    global_motionModelMutex.unlock();
+    
+    if (predicted)
+    {
+        result.markerCount = HUMANOID_RIG_POINT_COUNT;
+        result.radius = MARKER_PREDICTION_RADIUS_CM +
+            MARKER_PREDICTION_ERROR_FACTOR * prediction.predictionErrorRms;
+        memcpy(result.positions,
+               prediction.points,
+               HUMANOID_RIG_POINT_COUNT * sizeof(V3));
+    }
+    
+    return result;
+}
+
+static void answerRigPredictionRequest(MemoryArena* arena,
+                                       TransmissionState* requestState,
+                                       RigMotionModel* motionModel,
+                                       Message* msg)
+{
+    RigPrediction prediction = {};
+    bool32 predicted = 0;
+    
+    if (msg->header.type == MessageType_RigPredictionRequest &&
+        msg->header.payloadSize >= sizeof(RigPredictionRequest))
+    {
+        RigPredictionRequest* request = (RigPredictionRequest*)msg->data;
+        u64 targetTimestampUs = request->targetTimestampUs;
+        if (!targetTimestampUs)
+        {
+            targetTimestampUs = getMonotonicTimeInUs() + request->leadUs;
+        }
+        
+        global_motionModelMutex.lock();
+        predicted = predictRig(motionModel, targetTimestampUs, &prediction);
+        if (predicted)
+        {
+            motionModel->lastHorizonMs = prediction.horizonMs;
+        }
+        global_motionModelMutex.unlock();
+    }
+    
+    // NOTE(jan): a reply socket has to answer every request, an empty
+    // message tells the consumer there is no rig to predict
+    if (predicted)
+    {
+        sendMessage(arena,
+                    requestState,
+                    MessageType_RigPrediction,
+                    &prediction,
+                    sizeof(prediction),
+                    0);
+    }
+    else
+    {
+        sendMessage(arena,
+                    requestState,
+                    MessageType_None,
+                    &prediction,
+                    0,
+                    0);
+    }
+}
+
+// NOTE(jan): runs beside the tracking loop. Answers prediction requests
+// as they come in and publishes the rig extrapolated to now + lead at the
+// configured output rate, independent of the camera frame rate.
+static void rigOutputWorker(MemoryArena* outputArena,
+                            TransmissionState* requestState,
+                            Publisher* publisher,
+                            RigMotionModel* motionModel,
+                            RigOutputConfig config,
+                            ApplicationState* applicationState)
+{
+    u64 outputIntervalUs = 0;
+    if (config.outputRateHz > 0.0f)
+    {
+        outputIntervalUs = (u64)(1000000.0f / config.outputRateHz);
+    }
+    u64 nextOutputTimeUs = getMonotonicTimeInUs();
+    
+    Message msg = {};
+    
+    while (applicationState->status != ApplicationStatus_Exiting)
+    {
+        long timeoutMs = PREDICTION_IDLE_POLL_MS;
+        if (outputIntervalUs)
+        {
+            u64 now = getMonotonicTimeInUs();
+            timeoutMs = 0;
+            if (nextOutputTimeUs > now)
+            {
+                timeoutMs = (long)((nextOutputTimeUs - now) / 1000);
+            }
+        }
+        
+        zmq_pollitem_t pollItem = {};
+        pollItem.socket = requestState->socket;
+        pollItem.events = ZMQ_POLLIN;
+        zmq_poll(&pollItem, 1, timeoutMs);
+        
+        if (pollItem.revents & ZMQ_POLLIN)
+        {
+            while (receiveMessageNonBlocking(outputArena,
+                                             requestState,
+                                             &msg))
+            {
+                answerRigPredictionRequest(outputArena,
+                                           requestState,
+                                           motionModel,
+                                           &msg);
+            }
+        }
+        
+        if (outputIntervalUs)
+        {
+            u64 now = getMonotonicTimeInUs();
+            
+            // NOTE(jan): zmq_poll only has ms resolution, sleep off the
+            // rest of the interval
+            if (nextOutputTimeUs > now &&
+                nextOutputTimeUs - now < 1000)
+            {
+                usleep(nextOutputTimeUs - now);
+                now = getMonotonicTimeInUs();
+            }
+            
+            if (now >= nextOutputTimeUs)
+            {
+                RigPrediction prediction = {};
+                
+                global_motionModelMutex.lock();
+                bool32 predicted = predictRig(motionModel,
+                                              now + config.leadMs * 1000,
+                                              &prediction);
+                if (predicted)
+                {
+                    motionModel->lastHorizonMs = prediction.horizonMs;
+                }
+                global_motionModelMutex.unlock();
+                
+                if (predicted)
+                {
+                    publishMessage(publisher,
+                                   PublisherTopic_Prediction,
+                                   MessageType_RigPrediction,
+                                   &prediction,
+                                   sizeof(prediction),
+                                   0);
+                }
+                
+                // NOTE(jan): missed ticks are skipped, not made up for
+                nextOutputTimeUs += outputIntervalUs;
+                if (nextOutputTimeUs <= now)
+                {
+                    nextOutputTimeUs = now + outputIntervalUs;
+                }
+            }
+        }
+        
+        flushMemory(outputArena);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef B_PREDICTION_H
+
+// NOTE(jan): gains of the per-joint alpha-beta filter, higher values follow
+// the observations more closely but also pass on more of their jitter
+#define PREDICTION_ALPHA 0.85f
+#define PREDICTION_BETA 0.3f
+
+// NOTE(jan): the constant velocity model is useless far past the last
+// observation, so no prediction reaches further than this
+#define PREDICTION_MAX_HORIZON_MS 100.0f
+
+// NOTE(jan): observations further apart than this restart the model
+#define PREDICTION_RESET_INTERVAL_MS 500.0f
+
+#define PREDICTION_ERROR_SMOOTHING 0.05f
+
+#define PREDICTION_IDLE_POLL_MS 10
+#define PREDICTION_OUTPUT_MEMORY_SIZE megabytes(1)
+
+// NOTE(jan): radius around every predicted marker the spotters search,
+// grows with the measured prediction error
+#define MARKER_PREDICTION_RADIUS_CM 6.0f
+#define MARKER_PREDICTION_ERROR_FACTOR 3.0f
+#define MARKER_PREDICTION_FRAME_LEAD 2
+
+std::mutex global_motionModelMutex;
+
+struct JointMotion
+{
+    V3 position;
+    V3 velocity; // per second
+};
+
+struct RigMotionModel
+{
+    JointMotion joints[HUMANOID_RIG_POINT_COUNT];
+    u64 timestampUs;
+    u64 observationIntervalUs;
+    u64 observationCount;
+    bool32 isValid;
+    
+    // NOTE(jan): smoothed rms distance between the one step ahead
+    // prediction and the observation that followed it
+    r32 predictionErrorRms;
+    r32 lastHorizonMs;
+};
+
+// NOTE(jan): payload of MessageType_RigPredictionRequest. The target is a
+// beholder monotonic timestamp, consumers on another machine leave it at
+// 0 and pass a lead relative to the arrival of the request instead.
+struct RigPredictionRequest
+{
+    u64 targetTimestampUs;
+    i32 leadUs;
+};
+
+// NOTE(jan): payload of MessageType_RigPrediction
+struct RigPrediction
+{
+    u64 observationTimestampUs;
+    u64 targetTimestampUs;
+    r32 horizonMs; // after clamping to PREDICTION_MAX_HORIZON_MS
+    r32 predictionErrorRms;
+    V3 points[HUMANOID_RIG_POINT_COUNT];
+};
+
+struct RigOutputConfig
+{
+    r32 outputRateHz; // 0 = only answer requests
+    i32 leadMs;
+};
+
+#define B_PREDICTION_H
+#endif
@@ -0,0 +1,413 @@
+#include "b_publisher.h"
+
+// NOTE(jan): subscribers filter on the topic name, which is sent as its
+// own frame in front of the usual header + payload frame
+static const char* publisherTopicNames[PublisherTopic_Count] = {
+    "rig",
+    "intersections",
+    "rays",
+    "diagnostics",
+    "prediction"
+};
+
+static bool32 parsePublisherTopic(const char* name,
+                                  PublisherTopic* topic)
+{
+    bool32 result = 0;
+    
+    for (i32 topicIndex = 0;
+         topicIndex < PublisherTopic_Count;
+         topicIndex++)
+    {
+        if (strcmp(name, publisherTopicNames[topicIndex]) == 0)
+        {
+            *topic = (PublisherTopic)topicIndex;
+            result = 1;
+            break;
+        }
+    }
+    
+    return result;
+}
+
+static void initPublisher(MemoryArena* arena,
+                          Publisher* publisher,
+                          TransmissionState* sharedContext,
+                          std::string portNumber,
+                          TransmissionTransport transport)
+{
+    *publisher = {};
+    
+    u32 defaultIntervals[PublisherTopic_Count] = {
+        PUBLISHER_RIG_INTERVAL_MS,
+        PUBLISHER_INTERSECTIONS_INTERVAL_MS,
+        PUBLISHER_RAYS_INTERVAL_MS,
+        PUBLISHER_DIAGNOSTICS_INTERVAL_MS,
+        PUBLISHER_PREDICTION_INTERVAL_MS
+    };
+    
+    for (i32 topicIndex = 0;
+         topicIndex < PublisherTopic_Count;
+         topicIndex++)
+    {
+        PublisherTopicState* topic = &publisher->topics[topicIndex];
+        topic->name = publisherTopicNames[topicIndex];
+        topic->minIntervalMs = defaultIntervals[topicIndex];
+        topic->bufferSize = PUBLISHER_TOPIC_BUFFER_SIZE;
+        topic->buffer = (u8*)pushSize(arena, topic->bufferSize);
+    }
+    
+    TransmissionState* state = &publisher->transmissionState;
+    initTransmissionState(state, sharedContext);
+    openExtendedPublisherTransmissionChannel(state, portNumber, transport);
+    
+    // NOTE(jan): slow subscribers lose messages instead of piling them up
+    i32 highWaterMark = PUBLISHER_SEND_HIGH_WATER_MARK;
+    zmq_setsockopt(state->socket,
+                   ZMQ_SNDHWM,
+                   &highWaterMark,
+                   sizeof(highWaterMark));
+    i32 linger = 0;
+    zmq_setsockopt(state->socket,
+                   ZMQ_LINGER,
+                   &linger,
+                   sizeof(linger));
+}
+
+static void closePublisher(Publisher* publisher)
+{
+    closeTransmissionChannel(&publisher->transmissionState);
+    destroyTransmissionState(&publisher->transmissionState);
+}
+
+static void setPublisherRate(Publisher* publisher,
+                             PublisherTopic topic,
+                             r32 maxRateHz)
+{
+    u32 minIntervalMs = 0;
+    if (maxRateHz > 0.0f)
+    {
+        minIntervalMs = (u32)(1000.0f / maxRateHz);
+    }
+    
+    publisher->topics[topic].minIntervalMs = minIntervalMs;
+}
+
+// NOTE(jan): takes in the subscriptions that arrived on the xpub socket.
+// The caller has to hold global_publisherMutex.
+static void updatePublisherSubscriptions(Publisher* publisher)
+{
+    bool32 changed = 0;
+    
+    u8 message[PUBLISHER_MAX_SUBSCRIPTION_LENGTH + 1];
+    i32 size;
+    while ((size = zmq_recv(publisher->transmissionState.socket,
+                            message,
+                            sizeof(message),
+                            ZMQ_DONTWAIT)) > 0)
+    {
+        // NOTE(jan): first byte 1 = subscribe, 0 = unsubscribe, followed
+        // by the prefix. Longer prefixes are cut, they still match the
+        // same topic names.
+        bool32 subscribe = (message[0] == 1);
+        u32 length = min(size, (i32)sizeof(message)) - 1;
+        char* prefix = (char*)message + 1;
+        
+        i32 existing = -1;
+        for (u32 i = 0; i < publisher->subscriptionCount; i++)
+        {
+            PublisherSubscription* subscription = &publisher->subscriptions[i];
+            if (subscription->length == length &&
+                memcmp(subscription->prefix, prefix, length) == 0)
+            {
+                existing = i;
+                break;
+            }
+        }
+        
+        if (subscribe && existing == -1 &&
+            publisher->subscriptionCount < PUBLISHER_MAX_SUBSCRIPTION_COUNT)
+        {
+            PublisherSubscription* subscription =
+                &publisher->subscriptions[publisher->subscriptionCount++];
+            memcpy(subscription->prefix, prefix, length);
+            subscription->length = length;
+        }
+        else if (!subscribe && existing != -1)
+        {
+            publisher->subscriptions[existing] =
+                publisher->subscriptions[--publisher->subscriptionCount];
+        }
+        changed = 1;
+    }
+    
+    if (changed)
+    {
+        for (i32 topicIndex = 0;
+             topicIndex < PublisherTopic_Count;
+             topicIndex++)
+        {
+            PublisherTopicState* topic = &publisher->topics[topicIndex];
+            u32 nameLength = strlen(topic->name);
+            
+            topic->hasSubscribers = 0;
+            for (u32 i = 0; i < publisher->subscriptionCount; i++)
+            {
+                PublisherSubscription* subscription = &publisher->subscriptions[i];
+                if (subscription->length <= nameLength &&
+                    memcmp(subscription->prefix, topic->name, subscription->length) == 0)
+                {
+                    topic->hasSubscribers = 1;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// NOTE(jan): whether a message on the topic would go out right now. Lets
+// callers skip assembling big messages that would only be thrown away.
+static bool32 isPublisherTopicDue(Publisher* publisher,
+                                  PublisherTopic topicIndex)
+{
+    PublisherTopicState* topic = &publisher->topics[topicIndex];
+    
+    global_publisherMutex.lock();
+    updatePublisherSubscriptions(publisher);
+    bool32 result = 
+        topic->hasSubscribers &&
+        getWallclockTimeInMs() >= topic->timeOfLastSend + topic->minIntervalMs;
+    if (!topic->hasSubscribers)
+    {
+        topic->skippedCount++;
+    }
+    global_publisherMutex.unlock();
+    
+    return result;
+}
+
+// NOTE(jan): sends every pending message whose topic is allowed to send
+// again. Never blocks, if zmq can't take a message it is dropped.
+// The caller has to hold global_publisherMutex.
+static void flushPendingTopics(Publisher* publisher)
+{
+    u64 now = getWallclockTimeInMs();
+    
+    for (i32 topicIndex = 0;
+         topicIndex < PublisherTopic_Count;
+         topicIndex++)
+    {
+        PublisherTopicState* topic = &publisher->topics[topicIndex];
+        
+        if (!topic->hasPending ||
+            now < topic->timeOfLastSend + topic->minIntervalMs)
+        {
+            continue;
+        }
+        
+        void* socket = publisher->transmissionState.socket;
+        i32 topicSent = zmq_send(socket,
+                                 topic->name,
+                                 strlen(topic->name),
+                                 ZMQ_SNDMORE | ZMQ_DONTWAIT);
+        i32 messageSent = -1;
+        if (topicSent != -1)
+        {
+            messageSent = zmq_send(socket,
+                                   topic->buffer,
+                                   topic->messageSize,
+                                   ZMQ_DONTWAIT);
+        }
+        
+        if (messageSent == -1)
+        {
+            topic->droppedCount++;
+        }
+        else
+        {
+            topic->publishedCount++;
+        }
+        
+        topic->hasPending = 0;
+        topic->timeOfLastSend = now;
+    }
+}
+
+static void flushPublisher(Publisher* publisher)
+{
+    global_publisherMutex.lock();
+    updatePublisherSubscriptions(publisher);
+    flushPendingTopics(publisher);
+    global_publisherMutex.unlock();
+}
+
+static void publishMessage(Publisher* publisher,
+                           PublisherTopic topicIndex,
+                           MessageType type,
+                           void* payload,
+                           u32 payloadSize,
+                           u8 spotterId)
+{
+    PublisherTopicState* topic = &publisher->topics[topicIndex];
+    u32 messageSize = sizeof(MessageHeader) + payloadSize;
+    
+    global_publisherMutex.lock();
+    
+    updatePublisherSubscriptions(publisher);
+    if (!topic->hasSubscribers)
+    {
+        topic->skippedCount++;
+        global_publisherMutex.unlock();
+        return;
+    }
+    
+    // NOTE(jan): counted and reported with the diagnostics, this happens
+    // every frame while it happens at all
+    if (messageSize > topic->bufferSize)
+    {
+        topic->oversizedCount++;
+        global_publisherMutex.unlock();
+        return;
+    }
+    
+    if (topic->hasPending)
+    {
+        topic->conflatedCount++;
+    }
+    
+    MessageHeader* header = (MessageHeader*)topic->buffer;
+    *header = {};
+    header->type = type;
+    header->spotterID = spotterId;
+    header->payloadSize = payloadSize;
+    
+    if (payloadSize)
+    {
+        memcpy(topic->buffer + sizeof(MessageHeader), payload, payloadSize);
+    }
+    
+    topic->messageSize = messageSize;
+    topic->hasPending = 1;
+    
+    flushPendingTopics(publisher);
+    
+    global_publisherMutex.unlock();
+}
+
+static void publishRays(MemoryArena* arena,
+                        Publisher* publisher,
+                        Bucket* buckets,
+                        i32 bucketCount)
+{
+    if (!isPublisherTopicDue(publisher, PublisherTopic_Rays))
+    {
+        return;
+    }
+    
+    TemporaryMemory tempMem = beginTemporaryMemory(arena);
+    
+    u32 rayCount = 0;
+    for (i32 i = 0; i < bucketCount; i++)
+    {
+        rayCount += buckets[i].used;
+    }
+    
+    PublisherTopicState* topic = &publisher->topics[PublisherTopic_Rays];
+    if (sizeof(MessageHeader) + rayCount * sizeof(Ray) > topic->bufferSize)
+    {
+        global_publisherMutex.lock();
+        topic->oversizedCount++;
+        global_publisherMutex.unlock();
+    }
+    else if (rayCount)
+    {
+        Ray* rays = (Ray*)pushSize(arena, rayCount * sizeof(Ray));
+        Ray* rayPtr = rays;
+        for (i32 i = 0; i < bucketCount; i++)
+        {
+            memcpy(rayPtr, buckets[i].rays, buckets[i].used * sizeof(Ray));
+            rayPtr += buckets[i].used;
+        }
+        
+        publishMessage(publisher,
+                       PublisherTopic_Rays,
+                       MessageType_DebugRays,
+                       rays,
+                       rayCount * sizeof(Ray),
+                       0);
+    }
+    
+    endTemporaryMemory(tempMem);
+}
+
+static void publishIntersections(MemoryArena* arena,
+                                 Publisher* publisher,
+                                 IntersectionVector* intersections)
+{
+    if (!isPublisherTopicDue(publisher, PublisherTopic_Intersections))
+    {
+        return;
+    }
+    
+    TemporaryMemory tempMem = beginTemporaryMemory(arena);
+    
+    V3* positions = (V3*)pushSize(arena, intersections->count * sizeof(V3));
+    u32 positionCount = 0;
+    for (i32 i = 0;
+         i < intersections->count;
+         i++)
+    {
+        Intersection* isect = &intersections->intersections[i];
+        if (!isect->deleted)
+        {
+            positions[positionCount++] = isect->position;
+        }
+    }
+    
+    publishMessage(publisher,
+                   PublisherTopic_Intersections,
+                   MessageType_DebugIntersections,
+                   positions,
+                   positionCount * sizeof(V3),
+                   0);
+    
+    endTemporaryMemory(tempMem);
+}
+
+// NOTE(jan): over all topics, for the diagnostics
+static u64 getPublisherDroppedCount(Publisher* publisher)
+{
+    u64 result = 0;
+    
+    global_publisherMutex.lock();
+    for (i32 topicIndex = 0;
+         topicIndex < PublisherTopic_Count;
+         topicIndex++)
+    {
+        PublisherTopicState* topic = &publisher->topics[topicIndex];
+        result += topic->droppedCount + topic->oversizedCount;
+    }
+    global_publisherMutex.unlock();
+    
+    return result;
+}
+
+static void printPublisherStats(Publisher* publisher)
+{
+    printf("publisher:");
+    for (i32 topicIndex = 0;
+         topicIndex < PublisherTopic_Count;
+         topicIndex++)
+    {
+        PublisherTopicState* topic = &publisher->topics[topicIndex];
+        printf(" %s %" PRIu64 " published, %" PRIu64 " conflated, %" PRIu64 " dropped, "
+               "%" PRIu64 " too big, %" PRIu64 " unsubscribed;",
+               topic->name,
+               topic->publishedCount,
+               topic->conflatedCount,
+               topic->droppedCount,
+               topic->oversizedCount,
+               topic->skippedCount);
+    }
+    printf("\n");
+}
@@ -0,0 +1,70 @@
+#ifndef B_PUBLISHER_H
+
+#define PUBLISHER_SEND_HIGH_WATER_MARK 4
+#define PUBLISHER_TOPIC_BUFFER_SIZE kilobytes(64)
+#define PUBLISHER_MAX_SUBSCRIPTION_COUNT 32
+#define PUBLISHER_MAX_SUBSCRIPTION_LENGTH 32
+
+// NOTE(jan): default minimum time between two messages on a topic,
+// 0 means every message goes out
+#define PUBLISHER_RIG_INTERVAL_MS 0
+#define PUBLISHER_INTERSECTIONS_INTERVAL_MS 0
+#define PUBLISHER_RAYS_INTERVAL_MS 100
+#define PUBLISHER_DIAGNOSTICS_INTERVAL_MS 1000
+#define PUBLISHER_PREDICTION_INTERVAL_MS 0
+
+// NOTE(jan): the rig output worker publishes next to the tracking loop
+std::mutex global_publisherMutex;
+
+enum PublisherTopic
+{
+    PublisherTopic_Rig,
+    PublisherTopic_Intersections,
+    PublisherTopic_Rays,
+    PublisherTopic_Diagnostics,
+    PublisherTopic_Prediction,
+    PublisherTopic_Count
+};
+
+// NOTE(jan): every topic only keeps its newest message (conflation). 
+// It goes out as soon as the rate limit of the topic allows it.
+struct PublisherTopicState
+{
+    const char* name;
+    u32 minIntervalMs;
+    
+    u8* buffer;
+    u32 bufferSize;
+    u32 messageSize;
+    bool32 hasPending;
+    
+    bool32 hasSubscribers;
+    
+    u64 timeOfLastSend;
+    u64 publishedCount;
+    u64 conflatedCount;
+    u64 droppedCount;
+    u64 oversizedCount;
+    u64 skippedCount; // not subscribed to
+};
+
+// NOTE(jan): the xpub socket only reports the first subscription to a
+// prefix and the last unsubscription from it, so a set of prefixes is
+// all there is to keep
+struct PublisherSubscription
+{
+    char prefix[PUBLISHER_MAX_SUBSCRIPTION_LENGTH];
+    u32 length;
+};
+
+struct Publisher
+{
+    TransmissionState transmissionState;
+    PublisherTopicState topics[PublisherTopic_Count];
+    
+    PublisherSubscription subscriptions[PUBLISHER_MAX_SUBSCRIPTION_COUNT];
+    u32 subscriptionCount;
+};
+
+#define B_PUBLISHER_H
+#endif
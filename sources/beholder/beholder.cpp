@@ -43,15 +43,17 @@ static IntersectionVector mergeIntersections(MemoryArena* arena,
             
             if (lengthV3(subV3(p1, p2)) < mergeDistThreshold)
             {
-                V3 newPos = lerpV3(p1, p2, 0.5f);
-                i1->position = newPos;
+                r32 weight = i1->weight + i2->weight;
+                i1->position = lerpV3(i1->position, p2, i2->weight / weight);
+                i1->weight = weight;
                 i2->deleted = 1;
             }
         }
         
         pushIntersection(arena,
                          &result,
-                         i1->position);
+                         i1->position,
+                         i1->weight);
     }
     
     return result;
@@ -94,6 +96,7 @@ static IntersectionVector detectThreewayIntersections(MemoryArena* arena,
                  rayIndex++)
             {
                 Ray* ray = &cameraRays->rays[rayIndex];
+                r32 weight = cameraRays->weights[rayIndex];
                 RayInfoIntersectionList* rayIntersections =
                     &cameraIntersectionLists[rayIndex];
                 
@@ -103,13 +106,15 @@ static IntersectionVector detectThreewayIntersections(MemoryArena* arena,
                 {
                     V3 intersection;
                     Ray* compareRay = &compareCameraRays->rays[compareRayIndex];
+                    r32 compareWeight = compareCameraRays->weights[compareRayIndex];
                     r32 t1, t2;
                     
                     if (intersectRayRay(ray, 
                                         compareRay, 
                                         &intersection,
                                         &t1, &t2,
-                                        rayIntersectionThreshold))
+                                        rayIntersectionThreshold,
+                                        weight / (weight + compareWeight)))
                     {
                         insertRayInfoIntersectionSortedByT1(arena,
                                                             rayIntersections,
@@ -154,10 +159,14 @@ static IntersectionVector detectThreewayIntersections(MemoryArena* arena,
                         V3 p3 = {};
                         Ray* r1 = &buckets[i1->cameraIndex2].rays[i1->rayIndex2];
                         Ray* r2 = &buckets[i2->cameraIndex2].rays[i2->rayIndex2];
+                        r32 w0 = buckets[i1->cameraIndex1].weights[i1->rayIndex1];
+                        r32 w1 = buckets[i1->cameraIndex2].weights[i1->rayIndex2];
+                        r32 w2 = buckets[i2->cameraIndex2].weights[i2->rayIndex2];
                         intersectRayRay(r1, r2,
                                         &p3,
                                         &t1, &t2,
-                                        rayIntersectionThreshold);
+                                        rayIntersectionThreshold,
+                                        w1 / (w1 + w2));
                         
                         r32 distP1P3 = lengthV3(subV3(p1, p3));
                         r32 distP2P3 = lengthV3(subV3(p2, p3));
@@ -165,10 +174,18 @@ static IntersectionVector detectThreewayIntersections(MemoryArena* arena,
                         if (distP1P3 < rayIntersectionThreshold && 
                             distP2P3 < rayIntersectionThreshold)
                         {
-                            V3 position = lerpV3(lerpV3(p1, p2, 0.5f), p3, 0.5f);
+                            // NOTE(jan): every pairwise intersection
+                            // counts with the combined weight of its rays
+                            r32 w01 = w0 * w1 / (w0 + w1);
+                            r32 w02 = w0 * w2 / (w0 + w2);
+                            r32 w12 = w1 * w2 / (w1 + w2);
+                            V3 position = lerpV3(lerpV3(p1, p2, w02 / (w01 + w02)),
+                                                 p3,
+                                                 w12 / (w01 + w02 + w12));
                             pushIntersection(arena,
                                              &v, 
-                                             position);
+                                             position,
+                                             w0 + w1 + w2);
 #if 0
                             printf("Intersection found: r1->r2: %.2f, r1->r3: %.2f, r2->r3: %.2f\n",
                                    distP1P2, distP1P3, distP2P3);
@@ -218,6 +235,7 @@ static IntersectionVector detectIntersections(MemoryArena* arena,
                  rayIndex++)
             {
                 Ray* ray = &bucket->rays[rayIndex];
+                r32 weight = bucket->weights[rayIndex];
                 i32 compareRayId = 0;
                 r32 minT1 = FLT_MAX;
                 bool32 intersectionFound = 0;
@@ -229,13 +247,15 @@ static IntersectionVector detectIntersections(MemoryArena* arena,
                 {
                     V3 position;
                     Ray* compareRay = &compareBucket->rays[compareRayIndex];
+                    r32 compareWeight = compareBucket->weights[compareRayIndex];
                     
                     r32 t1, t2;
                     
                     if (intersectRayRay(ray, compareRay, 
                                         &position, 
                                         &t1, &t2, 
-                                        maxDist))
+                                        maxDist,
+                                        weight / (weight + compareWeight)))
                     {
 #if 0
                         if (t1 < minT1)
@@ -247,7 +267,8 @@ static IntersectionVector detectIntersections(MemoryArena* arena,
 #else
                         pushIntersection(arena,
                                          &v, 
-                                         position);
+                                         position,
+                                         weight + compareWeight);
 #endif
                     }
                     
@@ -1227,12 +1248,12 @@ static void handleAndSendDebugInfos(MemoryArena* flushArena,
         
         if (payloadSize)
         {
-            sendMessage(flushArena,
-                        transmissionState,
-                        MessageType_DebugRays,
-                        rays,
-                        payloadSize,
-                        0);
+            trySendMessage(flushArena,
+                           transmissionState,
+                           MessageType_DebugRays,
+                           rays,
+                           payloadSize,
+                           0);
         }
     }
     
@@ -1253,12 +1274,12 @@ static void handleAndSendDebugInfos(MemoryArena* flushArena,
                 printM4x4(&cameraPose);
                 printf("-------------------\n");
                 printf("Sending camera pose to mimic\n");
-                sendMessage(flushArena,
-                            transmissionState,
-                            MessageType_DebugCameraPose,
-                            payload,
-                            payloadSize,
-                            spotterId);
+                trySendMessage(flushArena,
+                               transmissionState,
+                               MessageType_DebugCameraPose,
+                               payload,
+                               payloadSize,
+                               spotterId);
             }
         }
     }
@@ -1283,12 +1304,12 @@ static void handleAndSendDebugInfos(MemoryArena* flushArena,
                        frame->memory,
                        frame->pitch * frame->height);
                 
-                sendMessage(flushArena,
-                            transmissionState,
-                            MessageType_DebugFrame,
-                            payload,
-                            payloadSize,
-                            spotterId);
+                trySendMessage(flushArena,
+                               transmissionState,
+                               MessageType_DebugFrame,
+                               payload,
+                               payloadSize,
+                               spotterId);
             }
         }
     }
@@ -1318,11 +1339,11 @@ static void handleAndSendDebugInfos(MemoryArena* flushArena,
     
     if (payload)
     {
-        sendMessage(flushArena,
-                    transmissionState,
-                    MessageType_DebugIntersections,
-                    payload,
-                    sizeof(V3) * isectCount,
-                    0);
+        trySendMessage(flushArena,
+                       transmissionState,
+                       MessageType_DebugIntersections,
+                       payload,
+                       sizeof(V3) * isectCount,
+                       0);
     }
 }
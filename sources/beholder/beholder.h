@@ -4,6 +4,25 @@
 #define CAMERA_COUNT 6
 #define TIMEWALK_COUNT 3
 
+// NOTE(jan): exposures of one frame set further apart than this are not
+// the same moment anymore, a bit less than a frame at 40 fps
+#define FRAME_SET_MAX_SPREAD_US 20000
+
+// NOTE(jan): the spotter clocks are mapped onto the beholder clock with
+// the smallest receive - send difference seen, which is renewed every
+// this many payloads to follow clock drift
+#define FRAME_TIMING_OFFSET_WINDOW 256
+#define FRAME_TIMING_STATS_INTERVAL_MS 5000
+
+// NOTE(jan): rays through blobs that don't look like markers are dropped
+// as soon as they arrive. The rest are weighted with the inverse variance
+// of their blob's centroid, spotters that don't send blob qualities get
+// the uncertainty of a centroid that is only known to a pixel.
+#define RAY_MIN_CIRCULARITY 0.4f
+#define RAY_MAX_CENTROID_UNCERTAINTY_PX 1.0f
+#define RAY_MIN_CENTROID_UNCERTAINTY_PX 0.02f
+#define RAY_DEFAULT_CENTROID_UNCERTAINTY_PX 0.3f
+
 enum ApplicationStatus
 {
     ApplicationStatus_None,
@@ -37,6 +56,7 @@ struct DebugInfos
 struct Intersection
 {
     V3 position;
+    r32 weight; // sum of the weights of the rays it was found with
     bool32 deleted;
 };
 
@@ -110,6 +130,7 @@ static inline IntersectionVector initializeIntersectionVector(MemoryArena* arena
 static inline void pushIntersection(MemoryArena* arena,
                                     IntersectionVector* vector,
                                     V3 position,
+                                    r32 weight = 1.0f,
                                     bool32 deleted = 0)
 {
     if(vector->count >= vector->maxCount)
@@ -127,6 +148,7 @@ static inline void pushIntersection(MemoryArena* arena,
     
     Intersection* intersection = &vector->intersections[vector->count];
     intersection->position = position;
+    intersection->weight = weight;
     intersection->deleted = deleted;
     
     vector->count++;
@@ -340,13 +362,40 @@ static inline void addRestrictionToRig(HumanoidRig* rig,
                        minVal, maxVal);
 }
 
+// NOTE(jan): rays are sorted by weight, best first
 struct Bucket
 {
     Ray rays[100];
+    r32 weights[100];
     i32 used;
     bool32 updatedSinceGet = 0;
 };
 
+// NOTE(jan): only touched by the messaging thread
+struct SpotterFrameTiming
+{
+    bool32 hasSequence;
+    u32 lastSequence;
+    u64 receivedFrameCount;
+    u64 droppedFrameCount;
+    
+    // NOTE(jan): beholder clock - spotter clock, including the smallest
+    // transmission delay
+    i64 clockOffsetUs;
+    i64 windowMinOffsetUs;
+    u32 offsetSampleCount;
+    
+    u32 binarizationThreshold; // of the last payload
+};
+
+// NOTE(jan): timestamps on the beholder clock
+struct FrameSetTiming
+{
+    u64 exposureTimestampUs; // earliest exposure in the set
+    u64 exposureSpreadUs;
+    u64 completedTimestampUs;
+};
+
 struct RayBuckets
 {
     // NOTE(jan): only the messaging thread is allowed to swap the indices,
@@ -358,8 +407,18 @@ struct RayBuckets
     bool32 _allBucketsUpdatedSinceGet = 0;
     
     Bucket buckets[RAY_BUCKET_COUNT][CAMERA_COUNT];
+    FrameSetTiming frameSetTimings[RAY_BUCKET_COUNT];
     i32 updatedClientsCount = 0;
+    u32 updatedClientsMask = 0;
     i32 clientCount = 0;
+    
+    u64 setMinExposureUs;
+    u64 setMaxExposureUs;
+    SpotterFrameTiming spotterTimings[CAMERA_COUNT];
+    
+    // NOTE(jan): written by the messaging thread, read under the bucket mutex
+    u64 _droppedFrameCount;
+    u64 _mismatchedFrameSetCount;
 };
 
 //NOTE(dave): For single thread use only
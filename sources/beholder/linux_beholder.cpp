@@ -5,12 +5,19 @@
 
 #include "../include/platform.h"
 #include "../include/math.h"
+#include "../include/rigbuffer.h"
 #include "b_transmission.cpp"
 #include "beholder.cpp"
 #include "b_datahandler.cpp"
+#include "b_publisher.cpp"
+#include "b_prediction.cpp"
 
 #define MULTITHREADED 1
 
+// NOTE(jan): messages queued for the push consumer on 5556 before they
+// are dropped, the tracking loop never waits for it
+#define CONSUMER_SEND_HIGH_WATER_MARK 4
+
 i32 main(i32 argc, const char* argv[])
 {
     printf("Starting initialisation \n");
@@ -20,6 +27,14 @@ i32 main(i32 argc, const char* argv[])
     bool32 _matchModel = 0;
     bool32 loadRaysFromFile = 0;
     ReadFileResult loadedBuckets = {};
+    TransmissionTransport spotterTransport = TransmissionTransport_Tcp;
+    TransmissionTransport consumerTransport = TransmissionTransport_Tcp;
+    r32 publisherRates[PublisherTopic_Count];
+    for (i32 topicIndex = 0; topicIndex < PublisherTopic_Count; topicIndex++)
+    {
+        publisherRates[topicIndex] = -1.0f;
+    }
+    RigOutputConfig rigOutputConfig = {};
     
     for (i32 i = 1; i < argc; i++)
     {
@@ -29,6 +44,60 @@ i32 main(i32 argc, const char* argv[])
             continue;
         }
         
+        // NOTE(jan): transport of the channels to the spotters
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            if (!parseTransmissionTransport(argv[i + 1], &spotterTransport))
+            {
+                return 1;
+            }
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): transport of the channel to the consumer
+        if (strcmp(argv[i], "-o") == 0)
+        {
+            if (!parseTransmissionTransport(argv[i + 1], &consumerTransport))
+            {
+                return 1;
+            }
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): maximum rate of a publisher topic in Hz, 0 = unlimited
+        if (strcmp(argv[i], "-p") == 0)
+        {
+            PublisherTopic topic;
+            if (!parsePublisherTopic(argv[i + 1], &topic))
+            {
+                printf("Unknown publisher topic %s\n", argv[i + 1]);
+                return 1;
+            }
+            publisherRates[topic] = atof(argv[i + 2]);
+            i += 2;
+            continue;
+        }
+        
+        // NOTE(jan): rate in Hz at which the extrapolated rig is published,
+        // independent of the camera frame rate
+        if (strcmp(argv[i], "-u") == 0)
+        {
+            rigOutputConfig.outputRateHz = atof(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): how many ms ahead of now the published rig is
+        // extrapolated, e.g. the latency from here to the display
+        if (strcmp(argv[i], "-l") == 0)
+        {
+            rigOutputConfig.leadMs = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
         if (strcmp(argv[i], "-r") == 0)
         {
             loadRaysFromFile = 1;
@@ -76,10 +145,17 @@ i32 main(i32 argc, const char* argv[])
     TransmissionState spotterReceiverTransmissionState = {};
     TransmissionState sendTransmissionState = {};
     TransmissionState spotterSenderTransmissionState = {};
+    TransmissionState predictionRequestTransmissionState = {};
     
+    // NOTE(jan): all channels share one context, so in-process spotter
+    // emulators can connect via inproc
     initTransmissionState(&spotterReceiverTransmissionState);
-    initTransmissionState(&sendTransmissionState);
-    initTransmissionState(&spotterSenderTransmissionState);
+    initTransmissionState(&sendTransmissionState,
+                          &spotterReceiverTransmissionState);
+    initTransmissionState(&spotterSenderTransmissionState,
+                          &spotterReceiverTransmissionState);
+    initTransmissionState(&predictionRequestTransmissionState,
+                          &spotterReceiverTransmissionState);
     
     RayBuckets* _rayBuckets = pushStruct(&permanentArena, RayBuckets);
     initRayBuckets(_rayBuckets);
@@ -87,18 +163,73 @@ i32 main(i32 argc, const char* argv[])
     DebugInfos* _debugInfos = pushStruct(&permanentArena, DebugInfos);
     *_debugInfos = {};
     
+    // NOTE(jan): local consumers can read the rig from shared memory
+    // instead of pulling it from port 5556
+    assert(HUMANOID_RIG_POINT_COUNT == RIG_BUFFER_POINT_COUNT);
+    static_assert(sizeof(V3) == sizeof(RigBufferPoint), "rig points don't match");
+    RigBufferMapping rigBuffer = {};
+    if (openRigBuffer(&rigBuffer, 1))
+    {
+        printf("Writing rig to shared memory %s\n", RIG_BUFFER_NAME);
+    }
+    
+    RigMotionModel* motionModel = pushStruct(&permanentArena, RigMotionModel);
+    *motionModel = {};
+    
+    MarkerPrediction* _markerPrediction = pushStruct(&permanentArena, MarkerPrediction);
+    *_markerPrediction = {};
+    
+    MemoryArena outputArena;
+    initMemoryArena(&outputArena,
+                    PREDICTION_OUTPUT_MEMORY_SIZE,
+                    pushSize(&permanentArena, PREDICTION_OUTPUT_MEMORY_SIZE));
+    
     printf("Everything initiated \n");
     
     flushMemory(&flushArena);
     
     openPullTransmissionChannel(&spotterReceiverTransmissionState,
-                                "5557");
+                                "5557",
+                                spotterTransport);
     openPublisherTransmissionChannel(&spotterSenderTransmissionState,
-                                     "5560");
+                                     "5560",
+                                     spotterTransport);
     openPushTransmissionChannel(&sendTransmissionState,
                                 "localhost",
                                 "5556",
-                                0);
+                                0,
+                                consumerTransport);
+    i32 consumerHighWaterMark = CONSUMER_SEND_HIGH_WATER_MARK;
+    zmq_setsockopt(sendTransmissionState.socket,
+                   ZMQ_SNDHWM,
+                   &consumerHighWaterMark,
+                   sizeof(consumerHighWaterMark));
+    i32 consumerLinger = 0;
+    zmq_setsockopt(sendTransmissionState.socket,
+                   ZMQ_LINGER,
+                   &consumerLinger,
+                   sizeof(consumerLinger));
+    openReplyTransmissionChannel(&predictionRequestTransmissionState,
+                                 "5562",
+                                 consumerTransport);
+    
+    // NOTE(jan): any number of consumers can subscribe to the tracking
+    // output here without ever stalling the tracking loop
+    Publisher publisher;
+    initPublisher(&permanentArena,
+                  &publisher,
+                  &spotterReceiverTransmissionState,
+                  "5561",
+                  consumerTransport);
+    for (i32 topicIndex = 0; topicIndex < PublisherTopic_Count; topicIndex++)
+    {
+        if (publisherRates[topicIndex] >= 0.0f)
+        {
+            setPublisherRate(&publisher,
+                             (PublisherTopic)topicIndex,
+                             publisherRates[topicIndex]);
+        }
+    }
     
     std::thread listener(messageHandler, 
                          &listenerArena, 
@@ -110,8 +241,19 @@ i32 main(i32 argc, const char* argv[])
                          &_saveRaysToFile, 
                          &_matchModel, 
                          &_debugStatus,
+                         _markerPrediction,
                          &_applicationState);
     
+    // NOTE(jan): consumers rendering faster than the cameras run get the
+    // rig extrapolated to their own frame times from here
+    std::thread rigOutput(rigOutputWorker,
+                          &outputArena,
+                          &predictionRequestTransmissionState,
+                          &publisher,
+                          motionModel,
+                          rigOutputConfig,
+                          &_applicationState);
+    
     i32 fileDescriptor = -1;
     
     bool32 modelMatched = 0;
@@ -158,6 +300,8 @@ i32 main(i32 argc, const char* argv[])
         
         u64 startGetRaysTime = getWallclockTimeInMs();
         
+        FrameSetTiming frameSetTiming = {};
+        
         if (loadRaysFromFile)
         {
             readFromFileResult(&loadedBuckets,
@@ -167,7 +311,10 @@ i32 main(i32 argc, const char* argv[])
         }
         else
         {
-            while (!getBucketsIfAllUpdated(_rayBuckets, buckets, bucketCount))
+            while (!getBucketsIfAllUpdated(_rayBuckets,
+                                           buckets,
+                                           bucketCount,
+                                           &frameSetTiming))
             {
                 if (_applicationState.status == ApplicationStatus_Exiting)
                 {
@@ -178,6 +325,14 @@ i32 main(i32 argc, const char* argv[])
         }
         
         u64 endGetRaysTime = getWallclockTimeInMs();
+        
+        // NOTE(jan): the motion model runs on exposure time, so jitter in
+        // processing and transmission does not show up as motion
+        u64 raysTimestampUs = frameSetTiming.exposureTimestampUs;
+        if (!raysTimestampUs)
+        {
+            raysTimestampUs = getMonotonicTimeInUs();
+        }
         u64 getRaysTime = endGetRaysTime - startGetRaysTime;
         
         u64 startDetectIntersectionsTime = getWallclockTimeInMs();
@@ -214,6 +369,14 @@ i32 main(i32 argc, const char* argv[])
                                 bucketCount,
                                 &intersectionsHC);
         
+        publishRays(&flushArena,
+                    &publisher,
+                    buckets,
+                    bucketCount);
+        publishIntersections(&flushArena,
+                             &publisher,
+                             &intersectionsHC);
+        
         u64 startHandleModelTime = getWallclockTimeInMs();
         
         global_flagMutex.lock();
@@ -232,12 +395,33 @@ i32 main(i32 argc, const char* argv[])
                 _matchModel = 0;
                 global_flagMutex.unlock();
                 
-                sendMessage(&flushArena,
-                            &sendTransmissionState,
-                            MessageType_Payload,
-                            _applicationState.rig.points,
-                            13 * sizeof(V3),
-                            0);
+                trySendMessage(&flushArena,
+                               &sendTransmissionState,
+                               MessageType_Payload,
+                               _applicationState.rig.points,
+                               13 * sizeof(V3),
+                               0);
+                
+                publishMessage(&publisher,
+                               PublisherTopic_Rig,
+                               MessageType_Payload,
+                               _applicationState.rig.points,
+                               HUMANOID_RIG_POINT_COUNT * sizeof(V3),
+                               0);
+                
+                if (rigBuffer.buffer)
+                {
+                    writeRigBufferFrame(rigBuffer.buffer,
+                                        getMonotonicTimeInUs(),
+                                        (RigBufferPoint*)_applicationState.rig.points,
+                                        HUMANOID_RIG_POINT_COUNT);
+                }
+                
+                global_motionModelMutex.lock();
+                updateRigMotionModel(motionModel,
+                                     _applicationState.rig.points,
+                                     raysTimestampUs);
+                global_motionModelMutex.unlock();
             }
         }
         else if (modelMatched)
@@ -247,13 +431,45 @@ i32 main(i32 argc, const char* argv[])
                      &intersectionsHC,
                      &intersectionsLC);
             
-            sendMessage(&flushArena,
-                        &sendTransmissionState,
-                        MessageType_Payload,
-                        _applicationState.rig.points,
-                        13 * sizeof(V3),
-                        0);
+            trySendMessage(&flushArena,
+                           &sendTransmissionState,
+                           MessageType_Payload,
+                           _applicationState.rig.points,
+                           13 * sizeof(V3),
+                           0);
+            
+            publishMessage(&publisher,
+                           PublisherTopic_Rig,
+                           MessageType_Payload,
+                           _applicationState.rig.points,
+                           HUMANOID_RIG_POINT_COUNT * sizeof(V3),
+                           0);
+            
+            if (rigBuffer.buffer)
+            {
+                writeRigBufferFrame(rigBuffer.buffer,
+                                    getMonotonicTimeInUs(),
+                                    (RigBufferPoint*)_applicationState.rig.points,
+                                    HUMANOID_RIG_POINT_COUNT);
+            }
+            
+            global_motionModelMutex.lock();
+            updateRigMotionModel(motionModel,
+                                 _applicationState.rig.points,
+                                 raysTimestampUs);
+            global_motionModelMutex.unlock();
+        }
+        
+        // NOTE(jan): while the rig is tracked the spotters only search
+        // around the predicted markers
+        MarkerPrediction markerPrediction = {};
+        if (modelMatched)
+        {
+            markerPrediction = predictMarkers(motionModel);
         }
+        global_markerPredictionMutex.lock();
+        *_markerPrediction = markerPrediction;
+        global_markerPredictionMutex.unlock();
         
         u64 endHandleModelTime = getWallclockTimeInMs();
         u64 handleModelTime = endHandleModelTime - startHandleModelTime;
@@ -305,6 +521,46 @@ i32 main(i32 argc, const char* argv[])
         u64 endHandleDebugInfoTime = getWallclockTimeInMs();
         u64 handleDebugInfoTime = endHandleDebugInfoTime - startHandleDebugInfoTime;
         
+        TrackingDiagnostics diagnostics = {};
+        diagnostics.frameIndex = frameIndex;
+        diagnostics.clientCount = clientlist.clientCount;
+        for (i32 i = 0; i < bucketCount; i++)
+        {
+            diagnostics.rayCount += buckets[i].used;
+        }
+        diagnostics.intersectionCountHC = intersectionsHC.count;
+        diagnostics.intersectionCountLC = intersectionsLC.count;
+        diagnostics.modelMatched = modelMatched;
+        diagnostics.frameTime = getWallclockTimeInMs() - starttime;
+        diagnostics.getRaysTime = getRaysTime;
+        diagnostics.detectIntersectionsTime = detectIntersectionsTime;
+        diagnostics.handleModelTime = handleModelTime;
+        global_motionModelMutex.lock();
+        diagnostics.predictionHorizonMs = motionModel->lastHorizonMs;
+        diagnostics.predictionErrorRms = motionModel->predictionErrorRms;
+        global_motionModelMutex.unlock();
+        diagnostics.exposureSpreadMs = frameSetTiming.exposureSpreadUs / 1000.0f;
+        if (frameSetTiming.exposureTimestampUs)
+        {
+            diagnostics.exposureToTrackedMs =
+                (i64)(getMonotonicTimeInUs() - frameSetTiming.exposureTimestampUs) / 1000.0f;
+        }
+        global_bucketMutex.lock();
+        diagnostics.droppedFrameCount = (u32)_rayBuckets->_droppedFrameCount;
+        diagnostics.mismatchedFrameSetCount = (u32)_rayBuckets->_mismatchedFrameSetCount;
+        global_bucketMutex.unlock();
+        diagnostics.publisherDroppedCount = (u32)getPublisherDroppedCount(&publisher);
+        diagnostics.consumerDroppedCount = (u32)sendTransmissionState.droppedCount;
+        publishMessage(&publisher,
+                       PublisherTopic_Diagnostics,
+                       MessageType_Diagnostics,
+                       &diagnostics,
+                       sizeof(diagnostics),
+                       0);
+        
+        // NOTE(jan): send out whatever was held back by the rate limits
+        flushPublisher(&publisher);
+        
         flushMemory(&flushArena);
         
         u64 endtime = getWallclockTimeInMs();
@@ -343,13 +599,21 @@ i32 main(i32 argc, const char* argv[])
     }
     
     listener.join();
+    rigOutput.join();
+    
+    closeRigBuffer(&rigBuffer);
+    
+    printPublisherStats(&publisher);
+    closePublisher(&publisher);
     
     closeTransmissionChannel(&spotterReceiverTransmissionState);
     closeTransmissionChannel(&sendTransmissionState);
     closeTransmissionChannel(&spotterSenderTransmissionState);
-    destroyTransmissionState(&spotterReceiverTransmissionState);
+    closeTransmissionChannel(&predictionRequestTransmissionState);
     destroyTransmissionState(&sendTransmissionState);
     destroyTransmissionState(&spotterSenderTransmissionState);
+    destroyTransmissionState(&predictionRequestTransmissionState);
+    destroyTransmissionState(&spotterReceiverTransmissionState);
     
     return 0;
 }
@@ -0,0 +1,60 @@
+// NOTE(jan): minimal consumer of the rig the beholder writes to shared
+// memory, only includes rigbuffer.h and the system headers, as any
+// consumer outside of this repository would. Prints the newest frame
+// whenever a new one was written.
+#include <time.h>
+
+#include "../include/rigbuffer.h"
+
+int main(int argc, const char* argv[])
+{
+    RigBufferMapping mapping;
+    
+    // NOTE(jan): openRigBuffer refuses buffers with another magic,
+    // version or frame size
+    if (!openRigBuffer(&mapping, 0))
+    {
+        return 1;
+    }
+    
+    printf("Reading rig from %s, version %u, %u frames of %u points\n",
+           RIG_BUFFER_NAME,
+           mapping.buffer->header.version,
+           mapping.buffer->header.frameCount,
+           mapping.buffer->header.pointCount);
+    
+    uint64_t lastFrameIndex = UINT64_MAX;
+    uint64_t failedReadCount = 0;
+    while (1)
+    {
+        RigBufferFrame frame;
+        if (readRigBufferFrame(mapping.buffer, 0, &frame))
+        {
+            if (frame.frameIndex != lastFrameIndex)
+            {
+                lastFrameIndex = frame.frameIndex;
+                
+                RigBufferPoint* head = &frame.points[0];
+                printf("frame %llu at %llu us: head %.1f %.1f %.1f, %llu failed reads\n",
+                       (unsigned long long)frame.frameIndex,
+                       (unsigned long long)frame.timestampUs,
+                       head->x, head->y, head->z,
+                       (unsigned long long)failedReadCount);
+                fflush(stdout);
+            }
+        }
+        else
+        {
+            // NOTE(jan): nothing written yet or the writer kept
+            // overwriting the frame during all retries
+            failedReadCount++;
+        }
+        
+        timespec wait = {0, 1000000};
+        nanosleep(&wait, 0);
+    }
+    
+    closeRigBuffer(&mapping);
+    
+    return 0;
+}
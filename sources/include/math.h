@@ -601,6 +601,75 @@ struct M4x4inv
     M4x4 inv;
 };
 
+struct Quaternion
+{
+    r32 x, y, z, w;
+};
+
+// NOTE(jan): of the rotation in the upper 3x3 of m, which has to be
+// orthonormal
+static inline Quaternion quaternionFromM4x4(M4x4* m)
+{
+    Quaternion result;
+    
+    r32 r00 = m->e[0][0], r01 = m->e[1][0], r02 = m->e[2][0];
+    r32 r10 = m->e[0][1], r11 = m->e[1][1], r12 = m->e[2][1];
+    r32 r20 = m->e[0][2], r21 = m->e[1][2], r22 = m->e[2][2];
+    
+    r32 trace = r00 + r11 + r22;
+    if (trace > 0.0f)
+    {
+        r32 s = 2.0f * sqrtf(trace + 1.0f);
+        result.w = 0.25f * s;
+        result.x = (r21 - r12) / s;
+        result.y = (r02 - r20) / s;
+        result.z = (r10 - r01) / s;
+    }
+    else if (r00 > r11 && r00 > r22)
+    {
+        r32 s = 2.0f * sqrtf(1.0f + r00 - r11 - r22);
+        result.w = (r21 - r12) / s;
+        result.x = 0.25f * s;
+        result.y = (r01 + r10) / s;
+        result.z = (r02 + r20) / s;
+    }
+    else if (r11 > r22)
+    {
+        r32 s = 2.0f * sqrtf(1.0f + r11 - r00 - r22);
+        result.w = (r02 - r20) / s;
+        result.x = (r01 + r10) / s;
+        result.y = 0.25f * s;
+        result.z = (r12 + r21) / s;
+    }
+    else
+    {
+        r32 s = 2.0f * sqrtf(1.0f + r22 - r00 - r11);
+        result.w = (r10 - r01) / s;
+        result.x = (r02 + r20) / s;
+        result.y = (r12 + r21) / s;
+        result.z = 0.25f * s;
+    }
+    
+    return result;
+}
+
+static inline M4x4 rotationM4x4FromQuaternion(Quaternion q)
+{
+    M4x4 result = identityM4x4();
+    
+    result.e[0][0] = 1.0f - 2.0f * (q.y * q.y + q.z * q.z);
+    result.e[1][0] = 2.0f * (q.x * q.y - q.z * q.w);
+    result.e[2][0] = 2.0f * (q.x * q.z + q.y * q.w);
+    result.e[0][1] = 2.0f * (q.x * q.y + q.z * q.w);
+    result.e[1][1] = 1.0f - 2.0f * (q.x * q.x + q.z * q.z);
+    result.e[2][1] = 2.0f * (q.y * q.z - q.x * q.w);
+    result.e[0][2] = 2.0f * (q.x * q.z - q.y * q.w);
+    result.e[1][2] = 2.0f * (q.y * q.z + q.x * q.w);
+    result.e[2][2] = 1.0f - 2.0f * (q.x * q.x + q.y * q.y);
+    
+    return result;
+}
+
 // TODO(jan): M4x4 doesn't make any sense, use M4x3 and V3 as result
 static V4 gaussianEliminationM4x4(M4x4 m)
 {
@@ -854,10 +923,13 @@ static inline V3 pointOnRay(Ray* ray, r32 t)
 }
 
 // NOTE(jan): http://www.realtimerendering.com/intersections.html
+// The intersection is the point between the closest points of the two
+// rays, r1Share of the way from r2's towards r1's.
 static inline bool32 intersectRayRay(Ray* r1, Ray* r2, 
                                      V3* pIntersect,
                                      r32* t1, r32* t2,
-                                     r32 maxDist)
+                                     r32 maxDist,
+                                     r32 r1Share = 0.5f)
 {
     bool32 result = 0;
     
@@ -911,7 +983,7 @@ static inline bool32 intersectRayRay(Ray* r1, Ray* r2,
         
         if (*t1 >= 0.0f && *t2 >= 0.0f && rayDist <= maxDist)
         {
-            V3 rayPoint = pointOnRay(&rIntersect, 0.5f);
+            V3 rayPoint = pointOnRay(&rIntersect, r1Share);
             
             // Don't consider points under the floor
             // TODO(jan): arbitrary threshold
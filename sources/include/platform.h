@@ -79,6 +79,17 @@ inline void* pushSize_(MemoryArena* arena, size_t size)
     return result;
 }
 
+// NOTE(jan): alignment has to be a power of two
+#define pushSizeAligned(arena, size, alignment) pushSizeAligned_(arena, size, alignment)
+inline void* pushSizeAligned_(MemoryArena* arena, size_t size, size_t alignment)
+{
+    size_t address = (size_t)(arena->base + arena->used);
+    size_t padding = ((address + alignment - 1) & ~(alignment - 1)) - address;
+    pushSize_(arena, padding);
+    
+    return pushSize_(arena, size);
+}
+
 struct TemporaryMemory
 {
     MemoryArena* arena;
@@ -252,6 +263,67 @@ static void readFromFileResult(ReadFileResult* file,
     }
 }
 
+struct MappedFile
+{
+    void* content;
+    u64 contentSize;
+};
+
+// NOTE(jan): read only and private, pages are only read when touched
+static bool32 mapEntireFile(const char* filename,
+                            MappedFile* file)
+{
+    bool32 result = 0;
+    *file = {};
+    
+    i32 fileDescriptor = open(filename, O_RDONLY);
+    if (fileDescriptor == -1)
+    {
+        printf("Could not open file %s\n", filename);
+        return 0;
+    }
+    
+    struct stat fileStats = {};
+    if (fstat(fileDescriptor, &fileStats) == -1 ||
+        fileStats.st_size == 0)
+    {
+        printf("Could not stat file %s or it is empty\n", filename);
+    }
+    else
+    {
+        void* content = mmap(0,
+                             fileStats.st_size,
+                             PROT_READ,
+                             MAP_PRIVATE,
+                             fileDescriptor,
+                             0);
+        if (content == MAP_FAILED)
+        {
+            printf("Could not map file %s\n", filename);
+        }
+        else
+        {
+            file->content = content;
+            file->contentSize = fileStats.st_size;
+            result = 1;
+        }
+    }
+    
+    // NOTE(jan): the mapping stays valid without the descriptor
+    close(fileDescriptor);
+    
+    return result;
+}
+
+static void unmapFile(MappedFile* file)
+{
+    if (file->content)
+    {
+        munmap(file->content, file->contentSize);
+    }
+    *file = {};
+}
+
 static i32 openFileForWriting(const char* filename)
 {
     i32 result = open(filename,
@@ -324,6 +396,16 @@ static u64 getWallclockTimeInMs()
     return result;
 }
 
+// NOTE(jan): monotonic, only comparable between processes on the same machine
+static u64 getMonotonicTimeInUs()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    u64 result = (u64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+    
+    return result;
+}
+
 static void getTimeString(char* buf,
                           int bufferSize)
 {
@@ -346,6 +428,16 @@ struct Frame
     i32 bytesPerPixel;
     i32 pitch;
     i32 size;
+    
+    // NOTE(jan): exposure time on the capturing machine's monotonic clock
+    // and the driver's frame counter, gaps in it are dropped frames
+    u64 timestampUs;
+    u32 sequence;
+    
+    // NOTE(jan): position of the first pixel in the full sensor image,
+    // only cropped frames start anywhere else than at 0, 0
+    i32 originX;
+    i32 originY;
 };
 
 static inline Frame initializeFrame(MemoryArena* arena,
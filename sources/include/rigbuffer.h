@@ -0,0 +1,228 @@
+#ifndef RIGBUFFER_H
+
+// NOTE(jan): shared memory ring holding the latest rig frames written by
+// the beholder. Readers map it read-only and never make a syscall after
+// that, the writer never waits for readers. Every frame is protected by
+// a seqlock: the sequence is odd while the frame is being written.
+//
+// Layout (all little endian, no padding besides the one listed):
+//   RigBufferHeader
+//   RigBufferFrame[frameCount]
+//
+// Consumers outside of this repository can include this header on its
+// own, it only needs the system headers below. See
+// beholder/linux_rigReader.cpp for a minimal reader.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define RIG_BUFFER_NAME "/mimikry_rig"
+#define RIG_BUFFER_MAGIC 0x4b52494d // "MIRK"
+#define RIG_BUFFER_VERSION 1
+#define RIG_BUFFER_FRAME_COUNT 16
+#define RIG_BUFFER_POINT_COUNT 13
+#define RIG_BUFFER_READ_RETRY_COUNT 16
+
+// NOTE(jan): in cm, same layout as the beholder's V3
+struct RigBufferPoint
+{
+    float x, y, z;
+};
+
+struct RigBufferFrame
+{
+    uint32_t sequence;
+    uint32_t pointCount;
+    uint64_t frameIndex;
+    // NOTE(jan): CLOCK_MONOTONIC, comparable between processes on one box
+    uint64_t timestampUs;
+    RigBufferPoint points[RIG_BUFFER_POINT_COUNT];
+    uint32_t padding;
+};
+
+struct RigBufferHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frameCount;
+    uint32_t frameSize;
+    uint32_t pointCount;
+    uint32_t padding;
+    // NOTE(jan): total number of frames ever written, the newest frame
+    // lives at (writeCount - 1) % frameCount
+    uint64_t writeCount;
+};
+
+static_assert(sizeof(RigBufferHeader) == 32, "rig buffer header layout changed");
+static_assert(sizeof(RigBufferFrame) == 184, "rig buffer frame layout changed");
+
+struct RigBuffer
+{
+    RigBufferHeader header;
+    RigBufferFrame frames[RIG_BUFFER_FRAME_COUNT];
+};
+
+struct RigBufferMapping
+{
+    RigBuffer* buffer;
+    int isWriter;
+};
+
+static int openRigBuffer(RigBufferMapping* mapping,
+                         int isWriter)
+{
+    int result = 0;
+    *mapping = {};
+    
+    int flags = isWriter ? (O_RDWR | O_CREAT) : O_RDONLY;
+    int fd = shm_open(RIG_BUFFER_NAME, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1)
+    {
+        printf("Could not open rig buffer %s: %s\n",
+               RIG_BUFFER_NAME, strerror(errno));
+        return result;
+    }
+    
+    if (isWriter && ftruncate(fd, sizeof(RigBuffer)) == -1)
+    {
+        printf("Could not resize rig buffer: %s\n", strerror(errno));
+        close(fd);
+        return result;
+    }
+    
+    void* memory = mmap(0, sizeof(RigBuffer),
+                        isWriter ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                        MAP_SHARED,
+                        fd, 0);
+    close(fd);
+    
+    if (memory == MAP_FAILED)
+    {
+        printf("Could not map rig buffer: %s\n", strerror(errno));
+        return result;
+    }
+    
+    RigBuffer* buffer = (RigBuffer*)memory;
+    
+    if (isWriter)
+    {
+        // NOTE(jan): invalidate first, readers only trust the buffer
+        // once magic and version are in place
+        __atomic_store_n(&buffer->header.magic, 0, __ATOMIC_RELEASE);
+        memset(buffer->frames, 0, sizeof(buffer->frames));
+        buffer->header.version = RIG_BUFFER_VERSION;
+        buffer->header.frameCount = RIG_BUFFER_FRAME_COUNT;
+        buffer->header.frameSize = sizeof(RigBufferFrame);
+        buffer->header.pointCount = RIG_BUFFER_POINT_COUNT;
+        __atomic_store_n(&buffer->header.writeCount, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&buffer->header.magic, RIG_BUFFER_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (__atomic_load_n(&buffer->header.magic, __ATOMIC_ACQUIRE) != RIG_BUFFER_MAGIC ||
+             buffer->header.version != RIG_BUFFER_VERSION ||
+             buffer->header.frameSize != sizeof(RigBufferFrame))
+    {
+        printf("Rig buffer has an incompatible layout\n");
+        munmap(memory, sizeof(RigBuffer));
+        return result;
+    }
+    
+    mapping->buffer = buffer;
+    mapping->isWriter = isWriter;
+    result = 1;
+    
+    return result;
+}
+
+static void closeRigBuffer(RigBufferMapping* mapping)
+{
+    if (mapping->buffer)
+    {
+        munmap(mapping->buffer, sizeof(RigBuffer));
+        
+        if (mapping->isWriter)
+        {
+            shm_unlink(RIG_BUFFER_NAME);
+        }
+    }
+    
+    *mapping = {};
+}
+
+// NOTE(jan): single writer only
+static void writeRigBufferFrame(RigBuffer* buffer,
+                                uint64_t timestampUs,
+                                RigBufferPoint* points,
+                                uint32_t pointCount)
+{
+    assert(pointCount <= RIG_BUFFER_POINT_COUNT);
+    
+    uint64_t writeCount = __atomic_load_n(&buffer->header.writeCount, __ATOMIC_RELAXED);
+    RigBufferFrame* frame = &buffer->frames[writeCount % RIG_BUFFER_FRAME_COUNT];
+    
+    uint32_t sequence = __atomic_load_n(&frame->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&frame->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    
+    frame->pointCount = pointCount;
+    frame->frameIndex = writeCount;
+    frame->timestampUs = timestampUs;
+    memcpy(frame->points, points, pointCount * sizeof(RigBufferPoint));
+    
+    __atomic_store_n(&frame->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&buffer->header.writeCount, writeCount + 1, __ATOMIC_RELEASE);
+}
+
+// NOTE(jan): age 0 is the newest frame, 1 the one before and so on.
+// Returns 0 if there is no such frame (yet) or the writer kept
+// overwriting it while we tried to read.
+static int readRigBufferFrame(RigBuffer* buffer,
+                              uint32_t age,
+                              RigBufferFrame* result)
+{
+    if (age >= RIG_BUFFER_FRAME_COUNT)
+    {
+        return 0;
+    }
+    
+    for (int retry = 0;
+         retry < RIG_BUFFER_READ_RETRY_COUNT;
+         retry++)
+    {
+        uint64_t writeCount = __atomic_load_n(&buffer->header.writeCount, __ATOMIC_ACQUIRE);
+        if (writeCount <= age)
+        {
+            return 0;
+        }
+        
+        uint64_t frameIndex = writeCount - 1 - age;
+        RigBufferFrame* frame = &buffer->frames[frameIndex % RIG_BUFFER_FRAME_COUNT];
+        
+        uint32_t sequenceBefore = __atomic_load_n(&frame->sequence, __ATOMIC_ACQUIRE);
+        if (sequenceBefore & 1)
+        {
+            continue;
+        }
+        
+        memcpy(result, frame, sizeof(RigBufferFrame));
+        
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t sequenceAfter = __atomic_load_n(&frame->sequence, __ATOMIC_RELAXED);
+        
+        if (sequenceBefore == sequenceAfter && result->frameIndex == frameIndex)
+        {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+#define RIGBUFFER_H
+#endif
@@ -16,7 +16,11 @@ enum MessageType
     MessageType_DebugCameraPose,
     MessageType_DebugRays,
     MessageType_DebugFrame,
-    MessageType_DebugIntersections
+    MessageType_DebugIntersections,
+    
+    MessageType_Diagnostics,
+    MessageType_RigPrediction,
+    MessageType_RigPredictionRequest
 };
 
 enum CommandType
@@ -33,7 +37,10 @@ enum CommandType
     CommandType_NoFrames,
     CommandType_StopSystem,
     CommandType_StartDebugging,
-    CommandType_StopDebugging
+    CommandType_StopDebugging,
+    CommandType_MarkerPrediction,
+    CommandType_AdaptiveThreshold,
+    CommandType_LearnStaticMask
 };
 
 struct MessageHeader
@@ -59,6 +66,84 @@ struct DebugFrameInfo
     i32 bytesPerPixel;
 };
 
+// NOTE(jan): starts every MessageType_Payload from a spotter, the rays
+// follow it, and after them a RayQuality for every ray if the spotter
+// has them. Timestamps are on the spotter's monotonic clock.
+struct PayloadHeader
+{
+    u64 exposureTimestampUs;
+    u64 sentTimestampUs;
+    u32 frameSequence;
+    u32 rayCount;
+    u32 binarizationThreshold; // the frame was extracted with
+};
+
+// NOTE(jan): what the spotter saw of the blob a ray was cast through
+struct RayQuality
+{
+    u16 area; // pixels
+    u8 peak;
+    u8 circularity; // minor over major axis, 255 for a disc
+    r32 centroidUncertainty; // rms, in pixels
+};
+
+#define MARKER_PREDICTION_MAX_COUNT 32
+
+// NOTE(jan): follows CommandType_MarkerPrediction. World space positions
+// the markers are expected at in the next frame, the spotters project
+// them into their own image to restrict the blob extraction to them.
+struct MarkerPrediction
+{
+    u32 markerCount;
+    r32 radius; // world space
+    V3 positions[MARKER_PREDICTION_MAX_COUNT];
+};
+
+// NOTE(jan): follows CommandType_AdaptiveThreshold. The spotters move
+// their binarization threshold between the bounds until they see
+// targetMarkerCount blobs, a target of 0 keeps the threshold fixed.
+struct AdaptiveThresholdConfig
+{
+    u32 targetMarkerCount;
+    u8 minThreshold;
+    u8 maxThreshold;
+};
+
+// NOTE(jan): published by the beholder on the diagnostics topic
+struct TrackingDiagnostics
+{
+    u32 frameIndex;
+    u32 clientCount;
+    u32 rayCount;
+    u32 intersectionCountHC;
+    u32 intersectionCountLC;
+    bool32 modelMatched;
+    
+    // NOTE(jan): durations of the last tracking frame in ms
+    u32 frameTime;
+    u32 getRaysTime;
+    u32 detectIntersectionsTime;
+    u32 handleModelTime;
+    
+    // NOTE(jan): state of the rig output prediction
+    r32 predictionHorizonMs;
+    r32 predictionErrorRms;
+    
+    // NOTE(jan): exposure timing of the tracked frame set
+    r32 exposureSpreadMs;
+    r32 exposureToTrackedMs;
+    u32 droppedFrameCount;
+    u32 mismatchedFrameSetCount;
+    
+    // NOTE(jan): messages the publisher dropped, because they were too
+    // big for their topic or zmq couldn't take them
+    u32 publisherDroppedCount;
+    
+    // NOTE(jan): rig and debug messages the push consumer on 5556 wasn't
+    // there for or didn't take fast enough
+    u32 consumerDroppedCount;
+};
+
 struct Message
 {
     MessageHeader header;
@@ -78,6 +163,19 @@ enum SendBufferType
     SendBufferType_Binarized
 };
 
+// NOTE(jan): Ipc is meant for co-located processes (spotter emulators,
+// beholder and consumer on one box). Inproc only works between
+// transmission states sharing the same zmq context in one process, so it
+// can't be picked on the command line, see initTransmissionState.
+enum TransmissionTransport
+{
+    TransmissionTransport_Tcp,
+    TransmissionTransport_Ipc,
+    TransmissionTransport_Inproc
+};
+
+#define TRANSMISSION_IPC_PATH "/tmp/mimikry-"
+
 struct TransmissionState
 {
     TransmissionStatus status;
@@ -86,6 +184,8 @@ struct TransmissionState
     // 0MQ Shizzle
     void* context;
     void* socket;   //ZMQ Socket
+    bool32 ownsContext;
+    u64 droppedCount; // see trySendMessage
     
     // TODO(jan): put somewhere smarter
     SendBufferType sendBufferType;
@@ -113,10 +213,73 @@ inline static std::string getLocalIP()
     return result;
 }
 
-inline static void initTransmissionState(TransmissionState* state)
+// NOTE(jan): sharedContext: pass the context of another transmission state
+// to be able to use the inproc transport between the two
+inline static void initTransmissionState(TransmissionState* state,
+                                         TransmissionState* sharedContext = 0)
 {
     state->status = TransmissionStatus_Ok;
-    state->context = zmq_ctx_new();
+    state->droppedCount = 0;
+    
+    if (sharedContext)
+    {
+        state->context = sharedContext->context;
+        state->ownsContext = 0;
+    }
+    else
+    {
+        state->context = zmq_ctx_new();
+        state->ownsContext = 1;
+    }
+}
+
+static bool32 parseTransmissionTransport(const char* name,
+                                         TransmissionTransport* transport)
+{
+    bool32 result = 1;
+    
+    if (strcmp(name, "tcp") == 0)
+    {
+        *transport = TransmissionTransport_Tcp;
+    }
+    else if (strcmp(name, "ipc") == 0)
+    {
+        *transport = TransmissionTransport_Ipc;
+    }
+    else
+    {
+        printf("Unknown transport %s, use tcp or ipc\n", name);
+        result = 0;
+    }
+    
+    return result;
+}
+
+// NOTE(jan): host is only used by the tcp transport, pass "*" when binding.
+// For ipc and inproc the port number only names the endpoint.
+inline static std::string getTransmissionAddress(TransmissionTransport transport,
+                                                 std::string host,
+                                                 std::string portNumber)
+{
+    std::string result;
+    
+    switch (transport)
+    {
+        case TransmissionTransport_Ipc: {
+            result = "ipc://" TRANSMISSION_IPC_PATH + portNumber;
+        } break;
+        
+        case TransmissionTransport_Inproc: {
+            result = "inproc://mimikry-" + portNumber;
+        } break;
+        
+        case TransmissionTransport_Tcp:
+        default: {
+            result = "tcp://" + host + ":" + portNumber;
+        } break;
+    }
+    
+    return result;
 }
 
 // NOTE(jan): keepOnlyLastMessage: this option deletes all messages queued up for 
@@ -124,22 +287,28 @@ inline static void initTransmissionState(TransmissionState* state)
 inline static void openPushTransmissionChannel(TransmissionState* state, 
                                                std::string serverIp,
                                                std::string portNumber,
-                                               bool32 keepOnlyLastMessage = 1)
+                                               bool32 keepOnlyLastMessage = 1,
+                                               TransmissionTransport transport = TransmissionTransport_Tcp)
 {
     state->socket = zmq_socket(state->context, ZMQ_PUSH);
     /*zmq_setsockopt(state->socket, 
                    ZMQ_CONFLATE, 
                    &keepOnlyLastMessage,
                    sizeof(keepOnlyLastMessage));*/
-    std::string serverAddress = "tcp://" + serverIp + ":" + portNumber;
+    std::string serverAddress = getTransmissionAddress(transport,
+                                                       serverIp,
+                                                       portNumber);
     zmq_connect(state->socket, serverAddress.c_str());
 }
 
 inline static void openPullTransmissionChannel(TransmissionState* state,
-                                               std::string portNumber)
+                                               std::string portNumber,
+                                               TransmissionTransport transport = TransmissionTransport_Tcp)
 {
     state->socket = zmq_socket(state->context, ZMQ_PULL);
-    std::string address = "tcp://*:" + portNumber;
+    std::string address = getTransmissionAddress(transport,
+                                                 "*",
+                                                 portNumber);
     i32 keepOnlyLastMessage = 1;
     /*zmq_setsockopt(state->socket, 
                    ZMQ_CONFLATE, 
@@ -151,10 +320,13 @@ inline static void openPullTransmissionChannel(TransmissionState* state,
 
 inline static void openSubscriberTransmissionChannel(TransmissionState* state, 
                                                      std::string serverIp,
-                                                     std::string portNumber)
+                                                     std::string portNumber,
+                                                     TransmissionTransport transport = TransmissionTransport_Tcp)
 {
     state->socket = zmq_socket(state->context, ZMQ_SUB);
-    std::string serverAddress = "tcp://" + serverIp + ":" + portNumber;
+    std::string serverAddress = getTransmissionAddress(transport,
+                                                       serverIp,
+                                                       portNumber);
     zmq_connect(state->socket, serverAddress.c_str());
     zmq_setsockopt(state->socket, 
                    ZMQ_SUBSCRIBE, 
@@ -163,30 +335,54 @@ inline static void openSubscriberTransmissionChannel(TransmissionState* state,
 }
 
 inline static void openPublisherTransmissionChannel(TransmissionState* state,
-                                                    std::string portNumber)
+                                                    std::string portNumber,
+                                                    TransmissionTransport transport = TransmissionTransport_Tcp)
 {
     state->socket = zmq_socket(state->context, ZMQ_PUB);
-    std::string address = "tcp://*:" + portNumber;
+    std::string address = getTransmissionAddress(transport,
+                                                 "*",
+                                                 portNumber);
+    
+    zmq_bind(state->socket, address.c_str());
+}
+
+// NOTE(jan): like a pub socket, but the subscriptions come in as messages
+// that have to be read off the socket, so the sender can skip topics
+// nobody listens to
+inline static void openExtendedPublisherTransmissionChannel(TransmissionState* state,
+                                                            std::string portNumber,
+                                                            TransmissionTransport transport = TransmissionTransport_Tcp)
+{
+    state->socket = zmq_socket(state->context, ZMQ_XPUB);
+    std::string address = getTransmissionAddress(transport,
+                                                 "*",
+                                                 portNumber);
     
     zmq_bind(state->socket, address.c_str());
 }
 
 inline static void openRequestTransmissionChannel(TransmissionState* state, 
                                                   std::string serverIp,
-                                                  std::string portNumber)
+                                                  std::string portNumber,
+                                                  TransmissionTransport transport = TransmissionTransport_Tcp)
 {
     state->socket = zmq_socket(state->context, ZMQ_REQ);
     
-    std::string serverAddress = "tcp://" + serverIp + ":" + portNumber;
+    std::string serverAddress = getTransmissionAddress(transport,
+                                                       serverIp,
+                                                       portNumber);
     zmq_connect(state->socket, serverAddress.c_str());
 }
 
 inline static void openReplyTransmissionChannel(TransmissionState* state, 
-                                                std::string portNumber)
+                                                std::string portNumber,
+                                                TransmissionTransport transport = TransmissionTransport_Tcp)
 {
     state->socket = zmq_socket(state->context, ZMQ_REP);
     
-    std::string serverAddress = "tcp://*:" + portNumber;
+    std::string serverAddress = getTransmissionAddress(transport,
+                                                       "*",
+                                                       portNumber);
     zmq_bind(state->socket, serverAddress.c_str());
 }
 
@@ -200,7 +396,10 @@ inline static void closeTransmissionChannel(TransmissionState* state)
 
 inline static void destroyTransmissionState(TransmissionState* state)
 {
-    zmq_ctx_destroy(state->context);
+    if (state->ownsContext)
+    {
+        zmq_ctx_destroy(state->context);
+    }
 }
 
 inline static void sendMessage(MemoryArena* arena,
@@ -232,6 +431,36 @@ inline static void sendMessage(MemoryArena* arena,
     }
 }
 
+// NOTE(jan): never blocks, a message zmq can't take right away (e.g. no
+// peer or the high water mark is reached) is dropped and counted
+inline static bool32 trySendMessage(MemoryArena* arena,
+                                    TransmissionState* transmissionState,
+                                    MessageType type,
+                                    void* payload,
+                                    u32 payloadSize,
+                                    u8 spotterId)
+{
+    MessageHeader* header = pushStruct(arena, MessageHeader);
+    header->type = type;
+    header->spotterID = spotterId;
+    header->payloadSize = payloadSize;
+    
+    memcpy((u8*)header + sizeof(MessageHeader), payload, payloadSize);
+    
+    i32 bytesSent = zmq_send(transmissionState->socket, 
+                             header, 
+                             payloadSize + sizeof(MessageHeader),
+                             ZMQ_DONTWAIT);
+    
+    bool32 result = (bytesSent != -1);
+    if (!result)
+    {
+        transmissionState->droppedCount++;
+    }
+    
+    return result;
+}
+
 static Message receiveMessageBlocking(MemoryArena* arena,
                                       TransmissionState* state) 
 {
@@ -69,7 +69,10 @@ public class MessageQueueHandler
         CommandType_NoFrames,
         CommandType_StopSystem,
         CommandType_StartDebugging,
-        commandType_StopDebugging
+        commandType_StopDebugging,
+        CommandType_MarkerPrediction,
+        CommandType_AdaptiveThreshold,
+        CommandType_LearnStaticMask
     };
     
     public struct CommandHeader
@@ -2,14 +2,28 @@
 #include <GLFW/glfw3.h>
 
 #define CALIBRATION_FRAME_COUNT 30
+#define CALIBRATION_MAX_FRAME_COUNT 100
+
+// NOTE(jan): see runBatchCalibration
+#define BATCH_CALIBRATION_FRAME_STEP 3
+#define BATCH_CALIBRATION_MIN_FRAME_COUNT 10
+#define BATCH_CALIBRATION_MAX_THREAD_COUNT 8
+#define BATCH_CALIBRATION_OUTLIER_FACTOR 2.0
 #define CHESSBOARD_INNER_COLUMN_COUNT 8
 #define CHESSBOARD_INNER_ROW_COUNT 5
 #define CHESSBOARD_FIELD_EDGE_IN_CM 4.25f
 
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <float.h>
+
 #include "../include/platform.h"
 #include "../include/math.h"
 #include "s_render.cpp"
 #include "s_capture.cpp"
+#include "s_recording.cpp"
+#include "s_replay.cpp"
 #include "s_analyzation.cpp"
 
 enum ApplicationStatus
@@ -43,71 +57,189 @@ struct CalibrationState
     cv::Mat lastImagePoints;
 };
 
-static bool32 CV_saveLastFrameAndCalibrate(CalibrationState* calibrationState,
-                                           i32 innerRowCount,
-                                           i32 innerColumnCount,
-                                           i32 cornerCount)
+// NOTE(jan): returns 1 once enough frames are collected to calibrate
+static bool32 CV_saveLastFrame(CalibrationState* calibrationState)
 {
     bool32 result = 0;
     
-    calibrationState->imagePoints.push_back(calibrationState->lastImagePoints);
-    calibrationState->detectedFrames++;
-    
-    if (calibrationState->detectedFrames >= CALIBRATION_FRAME_COUNT)
+    if (calibrationState->detectedFrames < CALIBRATION_FRAME_COUNT)
     {
-        printf("Collected enough points, starting calibration\n");
-        
-        // Calculate world points
-        r32 chessboardSizeInCm = CHESSBOARD_FIELD_EDGE_IN_CM;
-        
-        std::vector<std::vector<cv::Point3f>> allWorldPoints(1);
-        allWorldPoints[0].resize(cornerCount);
-        calculateChessboardWorldPoints(chessboardSizeInCm,
-                                       innerRowCount, innerColumnCount,
-                                       &allWorldPoints[0][0]);
-        
-        allWorldPoints.resize(CALIBRATION_FRAME_COUNT, allWorldPoints[0]);
-        
-        // Calibrate
-        cv::Mat cameraMat = cv::Mat::zeros(3, 3, CV_64F);
-        cv::Mat distortionMat = cv::Mat::zeros(5, 1, CV_64F);
-        std::vector<cv::Mat> rvecs, tvecs;
-        r64 reprojError = cv::calibrateCamera(allWorldPoints,
-                                              calibrationState->imagePoints,
-                                              cv::Size(WINDOW_WIDTH, 
-                                                       WINDOW_HEIGHT),
-                                              cameraMat,
-                                              distortionMat,
-                                              rvecs, tvecs);
-        
-        printf("reprojection error: %f\n", reprojError);
-        r64 fx = cameraMat.at<r64>(0, 0);
-        r64 fy = cameraMat.at<r64>(1, 1);
-        r64 cx = cameraMat.at<r64>(0, 2);
-        r64 cy = cameraMat.at<r64>(1, 2);
-        printf("fx: %f, fy: %f, cx: %f, cy: %f\n",
-               fx, fy, cx, cy);
-        r64 k1 = distortionMat.at<r64>(0, 0);
-        r64 k2 = distortionMat.at<r64>(1, 0);
-        r64 p1 = distortionMat.at<r64>(2, 0);
-        r64 p2 = distortionMat.at<r64>(3, 0);
-        r64 k3 = distortionMat.at<r64>(4, 0);
-        printf("distortion: %f, %f, %f, %f, %f\n",
-               k1, k2, p1, p2, k3);
+        calibrationState->imagePoints.push_back(calibrationState->lastImagePoints);
+        calibrationState->detectedFrames++;
         
-        calibrationState->calibration.fx = fx;
-        calibrationState->calibration.fy = fy;
-        calibrationState->calibration.cx = cx;
-        calibrationState->calibration.cy = cy;
-        calibrationState->calibration.distortion[0] = k1;
-        calibrationState->calibration.distortion[1] = k2;
-        calibrationState->calibration.distortion[2] = p1;
-        calibrationState->calibration.distortion[3] = p2;
-        calibrationState->calibration.distortion[4] = k3;
+        if (calibrationState->detectedFrames >= CALIBRATION_FRAME_COUNT)
+        {
+            printf("Collected enough points, starting calibration\n");
+            result = 1;
+        }
+    }
+    
+    return result;
+}
+
+// NOTE(jan): frameErrors gets the rms reprojection error of every frame,
+// frames far above the overall one are worth throwing out
+static r64 CV_calibrateCamera(std::vector<cv::Mat>* imagePoints,
+                              i32 frameWidth, i32 frameHeight,
+                              i32 innerRowCount, i32 innerColumnCount,
+                              Calibration* calibration,
+                              r64* frameErrors)
+{
+    i32 cornerCount = innerRowCount * innerColumnCount;
+    i32 frameCount = (i32)imagePoints->size();
+    
+    // Calculate world points
+    r32 chessboardSizeInCm = CHESSBOARD_FIELD_EDGE_IN_CM;
+    
+    std::vector<std::vector<cv::Point3f>> allWorldPoints(1);
+    allWorldPoints[0].resize(cornerCount);
+    calculateChessboardWorldPoints(chessboardSizeInCm,
+                                   innerRowCount, innerColumnCount,
+                                   &allWorldPoints[0][0]);
+    
+    allWorldPoints.resize(frameCount, allWorldPoints[0]);
+    
+    // Calibrate
+    cv::Mat cameraMat = cv::Mat::zeros(3, 3, CV_64F);
+    cv::Mat distortionMat = cv::Mat::zeros(5, 1, CV_64F);
+    std::vector<cv::Mat> rvecs, tvecs;
+    r64 reprojError = cv::calibrateCamera(allWorldPoints,
+                                          *imagePoints,
+                                          cv::Size(frameWidth, 
+                                                   frameHeight),
+                                          cameraMat,
+                                          distortionMat,
+                                          rvecs, tvecs);
+    
+    printf("reprojection error: %f\n", reprojError);
+    r64 fx = cameraMat.at<r64>(0, 0);
+    r64 fy = cameraMat.at<r64>(1, 1);
+    r64 cx = cameraMat.at<r64>(0, 2);
+    r64 cy = cameraMat.at<r64>(1, 2);
+    printf("fx: %f, fy: %f, cx: %f, cy: %f\n",
+           fx, fy, cx, cy);
+    r64 k1 = distortionMat.at<r64>(0, 0);
+    r64 k2 = distortionMat.at<r64>(1, 0);
+    r64 p1 = distortionMat.at<r64>(2, 0);
+    r64 p2 = distortionMat.at<r64>(3, 0);
+    r64 k3 = distortionMat.at<r64>(4, 0);
+    printf("distortion: %f, %f, %f, %f, %f\n",
+           k1, k2, p1, p2, k3);
+    
+    calibration->fx = fx;
+    calibration->fy = fy;
+    calibration->cx = cx;
+    calibration->cy = cy;
+    calibration->distortion[0] = k1;
+    calibration->distortion[1] = k2;
+    calibration->distortion[2] = p1;
+    calibration->distortion[3] = p2;
+    calibration->distortion[4] = k3;
+    
+    for (i32 frameIndex = 0; frameIndex < frameCount; frameIndex++)
+    {
+        std::vector<cv::Point2f> projectedPoints;
+        cv::projectPoints(allWorldPoints[frameIndex],
+                          rvecs[frameIndex],
+                          tvecs[frameIndex],
+                          cameraMat,
+                          distortionMat,
+                          projectedPoints);
         
-        calibrationState->isCalibrated = 1;
+        cv::Mat* framePoints = &(*imagePoints)[frameIndex];
+        r64 errorSqSum = 0.0;
+        for (i32 i = 0; i < cornerCount; i++)
+        {
+            cv::Point2f imagePoint = framePoints->at<cv::Point2f>(i, 0);
+            r64 dx = imagePoint.x - projectedPoints[i].x;
+            r64 dy = imagePoint.y - projectedPoints[i].y;
+            errorSqSum += dx * dx + dy * dy;
+        }
+        frameErrors[frameIndex] = sqrt(errorSqSum / cornerCount);
+    }
+    
+    return reprojError;
+}
+
+// NOTE(jan): calibrateCamera takes seconds with 30 frames, it runs on a
+// thread of its own so the preview doesn't freeze meanwhile
+struct CalibrationJob
+{
+    std::vector<cv::Mat> imagePoints;
+    i32 frameWidth, frameHeight;
+    i32 innerRowCount, innerColumnCount;
+    
+    std::thread worker;
+    std::mutex mutex;
+    bool32 running;
+    
+    // NOTE(jan): guarded by mutex
+    bool32 done;
+    Calibration calibration;
+    r64 reprojectionError;
+    r64 frameErrors[CALIBRATION_MAX_FRAME_COUNT];
+};
+
+static void calibrationWorker(CalibrationJob* job)
+{
+    Calibration calibration = {};
+    r64 frameErrors[CALIBRATION_MAX_FRAME_COUNT];
+    r64 reprojectionError = CV_calibrateCamera(&job->imagePoints,
+                                               job->frameWidth, job->frameHeight,
+                                               job->innerRowCount, job->innerColumnCount,
+                                               &calibration,
+                                               frameErrors);
+    
+    std::lock_guard<std::mutex> lock(job->mutex);
+    job->calibration = calibration;
+    job->reprojectionError = reprojectionError;
+    memcpy(job->frameErrors, frameErrors, job->imagePoints.size() * sizeof(r64));
+    job->done = 1;
+}
+
+static void startCalibrationJob(CalibrationJob* job,
+                                std::vector<cv::Mat>* imagePoints,
+                                i32 frameWidth, i32 frameHeight,
+                                i32 innerRowCount, i32 innerColumnCount)
+{
+    assert(!job->running);
+    assert(imagePoints->size() <= CALIBRATION_MAX_FRAME_COUNT);
+    
+    job->imagePoints = *imagePoints;
+    job->frameWidth = frameWidth;
+    job->frameHeight = frameHeight;
+    job->innerRowCount = innerRowCount;
+    job->innerColumnCount = innerColumnCount;
+    job->done = 0;
+    job->running = 1;
+    
+    job->worker = std::thread(calibrationWorker, job);
+}
+
+// NOTE(jan): returns 1 once, when the job is done, and hands the result
+// over to the calibration state. Only waits for the job if told to.
+static bool32 finishCalibrationJob(CalibrationJob* job,
+                                   CalibrationState* calibrationState,
+                                   bool32 wait)
+{
+    bool32 result = 0;
+    
+    if (job->running)
+    {
+        job->mutex.lock();
+        bool32 done = job->done;
+        job->mutex.unlock();
         
-        result = 1;
+        if (done || wait)
+        {
+            job->worker.join();
+            job->running = 0;
+            
+            calibrationState->calibration = job->calibration;
+            calibrationState->isCalibrated = 1;
+            
+            result = 1;
+        }
     }
     
     return result;
@@ -134,17 +266,358 @@ static bool32 CV_findImagePoints(CalibrationState* calibrationState,
     return result;
 }
 
+// NOTE(jan): what the selection of calibration frames looks at, where the
+// board is, how large and how much it is tilted either way
+enum BoardFeature
+{
+    BoardFeature_CenterX,
+    BoardFeature_CenterY,
+    BoardFeature_Scale,
+    BoardFeature_TiltX,
+    BoardFeature_TiltY,
+    BoardFeature_Count
+};
+
+struct BatchCalibrationFrame
+{
+    u32 frameIndex;
+    RecordingFrameHeader header;
+    u8* data;
+    
+    bool32 cornersFound;
+    cv::Mat imagePoints;
+    r32 features[BoardFeature_Count];
+};
+
+struct BatchDetection
+{
+    BatchCalibrationFrame* frames;
+    i32 frameCount;
+    i32 width, height;
+    i32 innerRowCount, innerColumnCount;
+    
+    std::mutex mutex;
+    i32 nextFrame; // guarded by mutex
+};
+
+static void describeBoard(BatchCalibrationFrame* frame,
+                          i32 width, i32 height,
+                          i32 innerRowCount, i32 innerColumnCount)
+{
+    i32 cornerCount = innerRowCount * innerColumnCount;
+    cv::Point2f topLeft = frame->imagePoints.at<cv::Point2f>(0, 0);
+    cv::Point2f topRight = frame->imagePoints.at<cv::Point2f>(innerColumnCount - 1, 0);
+    cv::Point2f bottomLeft = frame->imagePoints.at<cv::Point2f>(cornerCount - innerColumnCount, 0);
+    cv::Point2f bottomRight = frame->imagePoints.at<cv::Point2f>(cornerCount - 1, 0);
+    
+    V2 a = v2(topLeft.x, topLeft.y);
+    V2 b = v2(topRight.x, topRight.y);
+    V2 c = v2(bottomRight.x, bottomRight.y);
+    V2 d = v2(bottomLeft.x, bottomLeft.y);
+    
+    // NOTE(jan): shoelace formula over the outer corners
+    r32 area = 0.5f * fabsf((a.x * b.y - b.x * a.y) +
+                            (b.x * c.y - c.x * b.y) +
+                            (c.x * d.y - d.x * c.y) +
+                            (d.x * a.y - a.x * d.y));
+    
+    r32 top = lengthV2(subV2(b, a));
+    r32 bottom = lengthV2(subV2(c, d));
+    r32 left = lengthV2(subV2(d, a));
+    r32 right = lengthV2(subV2(c, b));
+    
+    frame->features[BoardFeature_CenterX] = 0.25f * (a.x + b.x + c.x + d.x) / (r32)width;
+    frame->features[BoardFeature_CenterY] = 0.25f * (a.y + b.y + c.y + d.y) / (r32)height;
+    frame->features[BoardFeature_Scale] = sqrtf(area / ((r32)width * (r32)height));
+    // NOTE(jan): the edge further away from the camera is shorter
+    frame->features[BoardFeature_TiltX] = logf(left / right);
+    frame->features[BoardFeature_TiltY] = logf(top / bottom);
+}
+
+static void batchDetectionWorker(BatchDetection* detection,
+                                 Frame* frame)
+{
+    i32 cornerCount = detection->innerRowCount * detection->innerColumnCount;
+    
+    while (1)
+    {
+        detection->mutex.lock();
+        i32 frameIndex = detection->nextFrame++;
+        detection->mutex.unlock();
+        
+        if (frameIndex >= detection->frameCount)
+        {
+            break;
+        }
+        
+        BatchCalibrationFrame* batchFrame = &detection->frames[frameIndex];
+        frame->width = detection->width;
+        frame->height = detection->height;
+        if (!decodeRecordingFrame(&batchFrame->header,
+                                  batchFrame->data,
+                                  frame))
+        {
+            continue;
+        }
+        
+        // NOTE(jan): corners of cropped frames would be in the wrong place
+        if (frame->width != detection->width ||
+            frame->height != detection->height)
+        {
+            continue;
+        }
+        
+        batchFrame->imagePoints = cv::Mat(cornerCount, 1, CV_32FC2);
+        batchFrame->cornersFound =
+            CV_findChessboardCorners(frame,
+                                     detection->innerRowCount,
+                                     detection->innerColumnCount,
+                                     &batchFrame->imagePoints.at<cv::Point2f>(0, 0));
+        
+        if (batchFrame->cornersFound)
+        {
+            describeBoard(batchFrame,
+                          detection->width, detection->height,
+                          detection->innerRowCount, detection->innerColumnCount);
+        }
+    }
+}
+
+// NOTE(jan): greedy farthest point sampling, starting with the largest
+// board every next frame is the one furthest away from all that were
+// picked so far. Neighbouring frames of a recording are nearly the same,
+// this spreads the selection over all the positions and tilts there are.
+static i32 selectCalibrationFrames(BatchCalibrationFrame** candidates,
+                                   i32 candidateCount,
+                                   BatchCalibrationFrame** selection,
+                                   i32 selectionCount)
+{
+    if (candidateCount <= selectionCount)
+    {
+        for (i32 i = 0; i < candidateCount; i++)
+        {
+            selection[i] = candidates[i];
+        }
+        return candidateCount;
+    }
+    
+    std::vector<r32> distances(candidateCount, FLT_MAX);
+    
+    i32 nextCandidate = 0;
+    for (i32 i = 1; i < candidateCount; i++)
+    {
+        if (candidates[i]->features[BoardFeature_Scale] >
+            candidates[nextCandidate]->features[BoardFeature_Scale])
+        {
+            nextCandidate = i;
+        }
+    }
+    
+    for (i32 selectedCount = 0; selectedCount < selectionCount; selectedCount++)
+    {
+        BatchCalibrationFrame* selected = candidates[nextCandidate];
+        selection[selectedCount] = selected;
+        distances[nextCandidate] = -1.0f; // never picked again
+        
+        r32 maxDistance = -1.0f;
+        for (i32 i = 0; i < candidateCount; i++)
+        {
+            r32 distance = 0.0f;
+            for (i32 feature = 0; feature < BoardFeature_Count; feature++)
+            {
+                r32 delta = candidates[i]->features[feature] - selected->features[feature];
+                distance += delta * delta;
+            }
+            
+            if (distance < distances[i])
+            {
+                distances[i] = distance;
+            }
+            if (distances[i] > maxDistance)
+            {
+                maxDistance = distances[i];
+                nextCandidate = i;
+            }
+        }
+    }
+    
+    return selectionCount;
+}
+
+// NOTE(jan): calibrates from a recording without any window or camera.
+// The corners are searched for in every BATCH_CALIBRATION_FRAME_STEP-th
+// frame on all cores, a spread out subset of the frames the board was
+// found in is calibrated with and the result written next to the
+// calibrations the interactive mode writes.
+static i32 runBatchCalibration(const char* filename,
+                               i32 selectionCount,
+                               i32 frameStep)
+{
+    i32 innerColumnCount = CHESSBOARD_INNER_COLUMN_COUNT;
+    i32 innerRowCount = CHESSBOARD_INNER_ROW_COUNT;
+    
+    MappedFile recording = {};
+    if (!mapEntireFile(filename, &recording))
+    {
+        return -1;
+    }
+    
+    i32 legacyWidth = 0;
+    i32 legacyHeight = 0;
+    getRecordingFrameSizeFromName(filename, &legacyWidth, &legacyHeight);
+    
+    RecordingReader reader;
+    if (!openRecordingReader(&reader,
+                             recording.content,
+                             recording.contentSize,
+                             legacyWidth,
+                             legacyHeight))
+    {
+        return -1;
+    }
+    i32 width = reader.header.width;
+    i32 height = reader.header.height;
+    
+    std::vector<BatchCalibrationFrame> frames;
+    RecordingFrameHeader frameHeader;
+    u8* data;
+    for (u32 frameIndex = 0;
+         peekRecordingFrame(&reader, &frameHeader, &data);
+         frameIndex++)
+    {
+        if (frameIndex % frameStep == 0)
+        {
+            BatchCalibrationFrame frame = {};
+            frame.frameIndex = frameIndex;
+            frame.header = frameHeader;
+            frame.data = data;
+            frames.push_back(frame);
+        }
+        skipRecordingFrame(&reader, &frameHeader, data);
+    }
+    
+    i32 threadCount = (i32)std::thread::hardware_concurrency();
+    threadCount = max(1, min(threadCount, BATCH_CALIBRATION_MAX_THREAD_COUNT));
+    printf("Searching for the chessboard in %i frames of %i x %i with %i threads\n",
+           (i32)frames.size(), width, height, threadCount);
+    
+    u64 permMemorySize = (u64)threadCount * width * height;
+    MemoryArena permArena;
+    initMemoryArena(&permArena, permMemorySize,
+                    mmap(0,
+                         permMemorySize,
+                         PROT_READ | PROT_WRITE,
+                         MAP_ANON | MAP_PRIVATE,
+                         -1, 0));
+    
+    BatchDetection detection;
+    detection.frames = frames.data();
+    detection.frameCount = (i32)frames.size();
+    detection.width = width;
+    detection.height = height;
+    detection.innerRowCount = innerRowCount;
+    detection.innerColumnCount = innerColumnCount;
+    detection.nextFrame = 0;
+    
+    u64 startTime = getMonotonicTimeInUs();
+    
+    std::thread workers[BATCH_CALIBRATION_MAX_THREAD_COUNT];
+    Frame workerFrames[BATCH_CALIBRATION_MAX_THREAD_COUNT];
+    for (i32 threadIndex = 0; threadIndex < threadCount; threadIndex++)
+    {
+        workerFrames[threadIndex] = initializeFrame(&permArena, width, height, 1);
+        workers[threadIndex] = std::thread(batchDetectionWorker,
+                                           &detection,
+                                           &workerFrames[threadIndex]);
+    }
+    for (i32 threadIndex = 0; threadIndex < threadCount; threadIndex++)
+    {
+        workers[threadIndex].join();
+    }
+    
+    std::vector<BatchCalibrationFrame*> candidates;
+    for (i32 i = 0; i < (i32)frames.size(); i++)
+    {
+        if (frames[i].cornersFound)
+        {
+            candidates.push_back(&frames[i]);
+        }
+    }
+    
+    printf("Chessboard found in %i frames in %.1f s\n",
+           (i32)candidates.size(),
+           (getMonotonicTimeInUs() - startTime) / 1000000.0f);
+    if (candidates.size() < BATCH_CALIBRATION_MIN_FRAME_COUNT)
+    {
+        printf("Not enough frames to calibrate with\n");
+        return -1;
+    }
+    
+    BatchCalibrationFrame* selection[CALIBRATION_MAX_FRAME_COUNT];
+    selectionCount = selectCalibrationFrames(candidates.data(),
+                                             (i32)candidates.size(),
+                                             selection,
+                                             selectionCount);
+    
+    std::vector<cv::Mat> imagePoints;
+    for (i32 i = 0; i < selectionCount; i++)
+    {
+        imagePoints.push_back(selection[i]->imagePoints);
+    }
+    
+    printf("Calibrating with %i frames\n", selectionCount);
+    CalibrationJob job;
+    job.running = 0;
+    startCalibrationJob(&job,
+                        &imagePoints,
+                        width, height,
+                        innerRowCount, innerColumnCount);
+    CalibrationState calibrationState = {};
+    finishCalibrationJob(&job, &calibrationState, 1);
+    
+    for (i32 i = 0; i < selectionCount; i++)
+    {
+        BatchCalibrationFrame* frame = selection[i];
+        r64 frameError = job.frameErrors[i];
+        printf("frame %5u: reprojection error %.3f px%s\n",
+               frame->frameIndex,
+               frameError,
+               (frameError > BATCH_CALIBRATION_OUTLIER_FACTOR * job.reprojectionError) ?
+               ", outlier" : "");
+    }
+    
+    char calibrationFilePath[100];
+    snprintf(calibrationFilePath,
+             100,
+             "calibrations/spotter_%ix%i.calib", 
+             width, height);
+    if (!writeToFile(calibrationFilePath, 
+                     &calibrationState.calibration,
+                     sizeof(Calibration)))
+    {
+        return -1;
+    }
+    printf("Calibration written to %s\n", calibrationFilePath);
+    
+    unmapFile(&recording);
+    
+    return 0;
+}
+
+// NOTE(jan): the corners are in pixels of a frame of the given size
 static void CV_drawChessboardCorners(RenderGroup* renderGroup,
                                      cv::Mat* cameraPoints,
-                                     i32 cornerCount)
+                                     i32 cornerCount,
+                                     i32 frameWidth,
+                                     i32 frameHeight)
 {
     // Rendering corners
     r32 cornerSize = 0.001f;
     for (i32 i = 0; i < cornerCount; i++)
     {
         cv::Point2f cameraPoint = cameraPoints->at<cv::Point2f>(i, 0);
-        r32 x = cameraPoint.x / (r32)CAPTURE_FRAME_WIDTH;
-        r32 y = cameraPoint.y / (r32)CAPTURE_FRAME_HEIGHT;
+        r32 x = cameraPoint.x / (r32)frameWidth;
+        r32 y = cameraPoint.y / (r32)frameHeight;
         
         V3 min = {x - cornerSize, y - cornerSize, 0.0f};
         V3 max = {x + cornerSize, y + cornerSize, 0.0f};
@@ -164,8 +637,8 @@ static void CV_drawChessboardCorners(RenderGroup* renderGroup,
     for (i32 i = 0; i < cornerCount; i++)
     {
         cv::Point2f cameraPoint = cameraPoints->at<cv::Point2f>(i, 0);
-        r32 x = cameraPoint.x / (r32)CAPTURE_FRAME_WIDTH;
-        r32 y = cameraPoint.y / (r32)CAPTURE_FRAME_HEIGHT;
+        r32 x = cameraPoint.x / (r32)frameWidth;
+        r32 y = cameraPoint.y / (r32)frameHeight;
         
         V3 min = {x - cornerSize, y - cornerSize, 0.0f};
         V3 max = {x + cornerSize, y + cornerSize, 0.0f};
@@ -305,18 +778,17 @@ static void handleInput(InputState* inputState,
 
 i32 main(i32 argc, const char* argv[])
 {
-    printf("Calibrating camera with size %ix%i\n",
-           CAPTURE_FRAME_WIDTH, CAPTURE_FRAME_HEIGHT);
-    
     CalibrationState calibrationState = {};
-    char calibrationFilePath[100];
-    snprintf(calibrationFilePath,
-             100,
-             "calibrations/spotter_%ix%i.calib", 
-             CAPTURE_FRAME_WIDTH, CAPTURE_FRAME_HEIGHT);
+    
+    // NOTE(jan): without -c the name is made from the frame size the
+    // driver agreed to, which is only known once capturing started
+    char calibrationFilePath[100] = {};
     ApplicationState applicationState = {};
     applicationState.status = ApplicationStatus_Calibrating;
     bool32 readFromFiles = 0;
+    const char* batchRecordingName = 0;
+    i32 batchFrameCount = CALIBRATION_FRAME_COUNT;
+    i32 batchFrameStep = BATCH_CALIBRATION_FRAME_STEP;
     
     for (i32 i = 1; i < argc; i++)
     {
@@ -354,8 +826,43 @@ i32 main(i32 argc, const char* argv[])
         {
             readFromFiles = 1;
         }
+        
+        // NOTE(jan): headless calibration from a recording, -bn is the
+        // number of frames to calibrate with, -bs the step between the
+        // frames that are searched for the board
+        if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            batchRecordingName = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-bn") == 0 && i + 1 < argc)
+        {
+            batchFrameCount = min(max(atoi(argv[i + 1]), BATCH_CALIBRATION_MIN_FRAME_COUNT),
+                                  CALIBRATION_MAX_FRAME_COUNT);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-bs") == 0 && i + 1 < argc)
+        {
+            batchFrameStep = max(atoi(argv[i + 1]), 1);
+            i++;
+            continue;
+        }
+    }
+    
+    if (batchRecordingName)
+    {
+        return runBatchCalibration(batchRecordingName,
+                                   batchFrameCount,
+                                   batchFrameStep);
     }
     
+    CalibrationJob calibrationJob;
+    calibrationJob.running = 0;
+    
     void* baseAddress = (void*)terabytes(2);
     u64 permMemorySize = megabytes(100);
     u64 transMemorySize = megabytes(100);
@@ -377,12 +884,26 @@ i32 main(i32 argc, const char* argv[])
     if (!startCapturing(&permArena,
                         &captureState,
                         CAPTURE_BUFFER_COUNT, 
-                        devName))
+                        devName,
+                        getDefaultCaptureConfig()))
     {
         printf("Could not initialize capture\n");
         return -1;
     }
     
+    i32 frameWidth = captureState.config.width;
+    i32 frameHeight = captureState.config.height;
+    printf("Calibrating camera with size %ix%i\n",
+           frameWidth, frameHeight);
+    
+    if (!calibrationFilePath[0])
+    {
+        snprintf(calibrationFilePath,
+                 100,
+                 "calibrations/spotter_%ix%i.calib", 
+                 frameWidth, frameHeight);
+    }
+    
     RenderState renderState = {};
     
     GLFWwindow* window = nullptr;
@@ -416,7 +937,7 @@ i32 main(i32 argc, const char* argv[])
     if (readFromFiles)
     {
         Frame fullGrayscaleFrame = initializeFrame(&permArena,
-                                                   CAPTURE_FRAME_WIDTH, CAPTURE_FRAME_HEIGHT,
+                                                   frameWidth, frameHeight,
                                                    1);
         frame = &fullGrayscaleFrame;
         
@@ -452,24 +973,27 @@ i32 main(i32 argc, const char* argv[])
             if (imagePointsFound)
             {
                 calibrationState.lastImagePoints = imagePoints;
-                bool32 calibrated = CV_saveLastFrameAndCalibrate(&calibrationState,
-                                                                 innerRowCount,
-                                                                 innerColumnCount,
-                                                                 cornerCount);
-                
-                if (calibrated)
+                if (CV_saveLastFrame(&calibrationState))
                 {
-                    applicationState.status = ApplicationStatus_DisplayFrames;
-                    
-                    printf("Camera calibrated\n");
-                    
-                    applicationState.status = ApplicationStatus_Calibrated;
-                    writeToFile(calibrationFilePath, 
-                                &calibrationState.calibration,
-                                sizeof(Calibration));
+                    startCalibrationJob(&calibrationJob,
+                                        &calibrationState.imagePoints,
+                                        fullGrayscaleFrame.width,
+                                        fullGrayscaleFrame.height,
+                                        innerRowCount,
+                                        innerColumnCount);
                 }
             }
         }
+        
+        if (finishCalibrationJob(&calibrationJob, &calibrationState, 1))
+        {
+            printf("Camera calibrated\n");
+            
+            applicationState.status = ApplicationStatus_Calibrated;
+            writeToFile(calibrationFilePath, 
+                        &calibrationState.calibration,
+                        sizeof(Calibration));
+        }
     }
     
     while (applicationState.status != ApplicationStatus_Exiting)
@@ -486,7 +1010,11 @@ i32 main(i32 argc, const char* argv[])
                 
                 if (!calibrationState.displayLastFrame)
                 {
-                    readFrame(&captureState, &frame);
+                    if (!readFrame(&captureState, &frame))
+                    {
+                        break;
+                    }
+                    
                     CV_resizeFrame(frame,
                                    &grayscaleFrame);
                     
@@ -523,7 +1051,9 @@ i32 main(i32 argc, const char* argv[])
                         {
                             CV_drawChessboardCorners(renderGroup,
                                                      &imagePoints,
-                                                     cornerCount);
+                                                     cornerCount,
+                                                     frameWidth,
+                                                     frameHeight);
                             
                             calibrationState.displayLastFrame = 1;
                             calibrationState.lastImagePoints = imagePoints;
@@ -555,7 +1085,9 @@ i32 main(i32 argc, const char* argv[])
                                     displayFrame.bytesPerPixel);
                     CV_drawChessboardCorners(renderGroup,
                                              &calibrationState.lastImagePoints,
-                                             cornerCount);
+                                             cornerCount,
+                                             frameWidth,
+                                             frameHeight);
                     
                     if (calibrationState.saveLastFrame)
                     {
@@ -583,15 +1115,24 @@ i32 main(i32 argc, const char* argv[])
                         calibrationState.saveLastFrame = 0;
                         calibrationState.displayLastFrame = 0;
                         
-                        calibrated = CV_saveLastFrameAndCalibrate(&calibrationState,
-                                                                  innerRowCount,
-                                                                  innerColumnCount,
-                                                                  cornerCount);
+                        if (CV_saveLastFrame(&calibrationState))
+                        {
+                            startCalibrationJob(&calibrationJob,
+                                                &calibrationState.imagePoints,
+                                                frame->width,
+                                                frame->height,
+                                                innerRowCount,
+                                                innerColumnCount);
+                        }
                         
                         calibrationState.displayLastFrame = 0;
                     }
                 }
                 
+                calibrated = finishCalibrationJob(&calibrationJob,
+                                                  &calibrationState,
+                                                  0);
+                
                 if (calibrated)
                 {
                     printf("Camera calibrated\n");
@@ -606,7 +1147,10 @@ i32 main(i32 argc, const char* argv[])
             case ApplicationStatus_Calibrated: {
                 
                 Frame* frame = 0;
-                readFrame(&captureState, &frame);
+                if (!readFrame(&captureState, &frame))
+                {
+                    break;
+                }
                 
                 CV_resizeFrame(frame,
                                &grayscaleFrame);
@@ -642,7 +1186,9 @@ i32 main(i32 argc, const char* argv[])
                 {
                     CV_drawChessboardCorners(renderGroup,
                                              &imagePoints,
-                                             cornerCount);
+                                             cornerCount,
+                                             frameWidth,
+                                             frameHeight);
                     
                     M4x4inv cTw = {};
                     CV_estimatePose(&transArena,
@@ -737,7 +1283,9 @@ i32 main(i32 argc, const char* argv[])
                 {
                     CV_drawChessboardCorners(renderGroup,
                                              &imagePoints,
-                                             cornerCount);
+                                             cornerCount,
+                                             frameWidth,
+                                             frameHeight);
                 }
             } break;
         }
@@ -775,6 +1323,7 @@ i32 main(i32 argc, const char* argv[])
         flushMemory(&transArena);
     }
     
+    finishCalibrationJob(&calibrationJob, &calibrationState, 1);
     stopCapturing(&captureState);
     
     glfwTerminate();
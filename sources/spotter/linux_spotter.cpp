@@ -2,10 +2,43 @@
 #define CHESSBOARD_INNER_ROW_COUNT 11
 #define CHESSBOARD_FIELD_EDGE_IN_CM 12.1f
 
-#define POSE_ESTIMATION_COUNT 1
-#define POSE_ESTIMATION_TIMEOUT_MS 10
+// NOTE(jan): solves from this many frames are averaged to the pose
+#define POSE_ESTIMATION_COUNT 5
 
-#define USE_CV_ANALYZATION 1
+#define USE_CV_ANALYZATION 0
+
+// NOTE(jan): with a marker prediction from the beholder only the regions
+// around the predicted markers are searched, but the whole frame is
+// still scanned every ROI_FULL_SCAN_INTERVAL frames
+#define ROI_FULL_SCAN_INTERVAL 30
+#define ROI_MAX_PREDICTION_AGE 1
+#define ROI_MARGIN_PIXELS 8.0f
+
+// NOTE(jan): tiles covered by a blob in this many of the frames the
+// static mask is learned over are masked
+#define STATIC_MASK_LEARNING_FRAMES 90
+#define STATIC_MASK_MIN_HIT_FRACTION 0.8f
+
+// NOTE(jan): with a tracking volume only the part of the image it
+// projects into is captured, cropped by the driver if it can
+#define CAPTURE_CROP_MARGIN_PIXELS 32.0f
+#define CAPTURE_CROP_MAX_AREA_FRACTION 0.9f
+
+// NOTE(jan): with a target marker count the binarization threshold
+// adapts itself, see adaptBinarizationThreshold
+#define ADAPTIVE_THRESHOLD_BACKGROUND_FRACTION 0.95f
+#define ADAPTIVE_THRESHOLD_NOISE_MARGIN 16
+#define ADAPTIVE_THRESHOLD_COUNT_TOLERANCE 1
+#define ADAPTIVE_THRESHOLD_SETTLE_FRAMES 5
+#define ADAPTIVE_THRESHOLD_STEP 4
+#define ADAPTIVE_THRESHOLD_DEFAULT_MIN 40
+#define ADAPTIVE_THRESHOLD_DEFAULT_MAX 250
+
+#define SEND_QUEUE_STATS_INTERVAL_MS 5000
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STBIW_ASSERT(x)
@@ -15,31 +48,46 @@
 #include "../include/math.h"
 #include "s_brightpiController.cpp"
 #include "s_capture.cpp"
+#include "s_recording.cpp"
+#include "s_replay.cpp"
 #include "s_analyzation.cpp"
+#include "s_extraction.cpp"
+#include "s_pose.cpp"
 #include "s_transmission.cpp"
 #include "s_spotter.cpp"
 
 i32 main(i32 argc, const char* argv[])
 {
-    printf("capture size: %i x %i, window size: %i x %i\n",
-           CAPTURE_FRAME_WIDTH, CAPTURE_FRAME_HEIGHT,
-           WINDOW_WIDTH, WINDOW_HEIGHT);
     std::string serverIp = "127.0.0.1";
     std::string portNumber = "5557";
     std::string handshakePortNumber = "5560";
     
-    char calibrationFilePath[100];
-    snprintf(calibrationFilePath,
-             100,
-             "calibrations/spotter_%ix%i.calib", 
-             WINDOW_WIDTH, WINDOW_HEIGHT);
-    
-    ReadFileResult loadedFrames;
-    bool32 readFramesFromFile = 0;
+    const char* replayFilename = 0;
+    r32 replaySpeed = 1.0f;
+    u32 replayStartFrame = 0;
+    bool32 replayLoop = 0;
     
     ReadFileResult loadedPose;
     bool32 loadPoseFromFile = 0;
     
+    TransmissionTransport transport = TransmissionTransport_Tcp;
+    i32 extractionThreadCount = EXTRACTION_THREAD_COUNT;
+    bool32 useExtractionTiles = 0;
+    CaptureConfig captureConfig = getDefaultCaptureConfig();
+    
+    RecordingEncoding recordingEncoding = RecordingEncoding_RunLength;
+    u8 recordingThreshold = RECORDING_DEFAULT_THRESHOLD;
+    
+    bool32 learnStaticMaskAtStart = 0;
+    
+    AdaptiveThresholdConfig adaptiveThreshold = {};
+    adaptiveThreshold.minThreshold = ADAPTIVE_THRESHOLD_DEFAULT_MIN;
+    adaptiveThreshold.maxThreshold = ADAPTIVE_THRESHOLD_DEFAULT_MAX;
+    
+    bool32 hasTrackingVolume = 0;
+    V3 trackingVolumeMin = {};
+    V3 trackingVolumeMax = {};
+    
     for (i32 i = 1; i < argc; i++)
     {
         if (strcmp(argv[i], "-s") == 0)
@@ -49,21 +97,158 @@ i32 main(i32 argc, const char* argv[])
             continue;
         }
         
-        if (strcmp(argv[i], "-r") == 0)
+        if (strcmp(argv[i], "-t") == 0)
         {
-            readFramesFromFile = 1;
-            std::string loadFilename = argv[i + 1];
+            if (!parseTransmissionTransport(argv[i + 1], &transport))
+            {
+                return 1;
+            }
             i++;
-            
-            bool32 readResult = readEntireFile(loadFilename.c_str(),
-                                               &loadedFrames);
-            if (!readResult)
+            continue;
+        }
+        
+        // NOTE(jan): capture size, e.g. -c 1280x720
+        if (strcmp(argv[i], "-c") == 0)
+        {
+            if (sscanf(argv[i + 1], "%ix%i",
+                       &captureConfig.width,
+                       &captureConfig.height) != 2)
+            {
+                printf("Capture size has to be given as <width>x<height>\n");
+                return 1;
+            }
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-f") == 0)
+        {
+            if (!parseCapturePixelFormat(argv[i + 1], &captureConfig))
+            {
+                return 1;
+            }
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-b") == 0)
+        {
+            captureConfig.binning = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-fps") == 0)
+        {
+            captureConfig.fps = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): encoding of recorded frames, raw, rle or delta
+        if (strcmp(argv[i], "-e") == 0)
+        {
+            if (!parseRecordingEncoding(argv[i + 1], &recordingEncoding))
             {
-                printf("Could not read frames from file %s\n",
-                       loadFilename.c_str());
+                return 1;
+            }
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): pixels at or below this are black in rle recordings
+        if (strcmp(argv[i], "-et") == 0)
+        {
+            recordingThreshold = (u8)atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): number of markers the binarization threshold is
+        // adapted to, 0 keeps it fixed
+        if (strcmp(argv[i], "-at") == 0)
+        {
+            adaptiveThreshold.targetMarkerCount = (u32)atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): learn the static mask as soon as detection starts,
+        // the tracking volume should be empty by then
+        if (strcmp(argv[i], "-sm") == 0)
+        {
+            learnStaticMaskAtStart = 1;
+            continue;
+        }
+        
+        // NOTE(jan): number of threads the blob extraction is split over
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            extractionThreadCount = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): skip dark tiles with a coarse pass before the run
+        // extraction, only pays off on frames that are mostly dark
+        if (strcmp(argv[i], "-tiles") == 0)
+        {
+            useExtractionTiles = 1;
+            continue;
+        }
+        
+        // NOTE(jan): tracking volume in world space (cm), e.g.
+        // -v -200 -200 0 200 200 250
+        if (strcmp(argv[i], "-v") == 0)
+        {
+            if (i + 6 >= argc)
+            {
+                printf("Tracking volume has to be given as "
+                       "<minX> <minY> <minZ> <maxX> <maxY> <maxZ>\n");
                 return 1;
             }
             
+            hasTrackingVolume = 1;
+            trackingVolumeMin = v3(atof(argv[i + 1]),
+                                   atof(argv[i + 2]),
+                                   atof(argv[i + 3]));
+            trackingVolumeMax = v3(atof(argv[i + 4]),
+                                   atof(argv[i + 5]),
+                                   atof(argv[i + 6]));
+            i += 6;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            replayFilename = argv[i + 1];
+            i++;
+            continue;
+        }
+        
+        // NOTE(jan): -rx 0 replays as fast as the frames are handled
+        if (strcmp(argv[i], "-rx") == 0)
+        {
+            replaySpeed = atof(argv[i + 1]);
+            if (replaySpeed < 0.0f)
+            {
+                printf("Replay speed can't be negative\n");
+                return 1;
+            }
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-rs") == 0)
+        {
+            replayStartFrame = (u32)atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-rl") == 0)
+        {
+            replayLoop = 1;
             continue;
         }
         
@@ -86,6 +271,73 @@ i32 main(i32 argc, const char* argv[])
         }
     }
     
+    void* baseAddress = (void*)terabytes(2);
+    u64 permanentMemorySize = megabytes(100);
+    u64 flushMemorySize = megabytes(50);
+    u64 totalMemorySize = permanentMemorySize + flushMemorySize;
+    u8* systemMemory = (u8*)mmap(baseAddress, 
+                                 totalMemorySize,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_ANON | MAP_PRIVATE,
+                                 -1, 0);
+    
+    MemoryArena permanentArena, flushArena;
+    initMemoryArena(&permanentArena, permanentMemorySize,
+                    (systemMemory));
+    initMemoryArena(&flushArena, flushMemorySize,
+                    (systemMemory+permanentMemorySize));
+    
+    CaptureState captureState = {};
+    ReplayState replay = {};
+    if (replayFilename)
+    {
+        // NOTE(jan): recordings without a header are assumed to have
+        // the size given with -c
+        if (!startReplay(&permanentArena,
+                         &captureState,
+                         &replay,
+                         replayFilename,
+                         captureConfig.width,
+                         captureConfig.height,
+                         replaySpeed,
+                         replayLoop))
+        {
+            printf("Could not replay frames from file %s\n", replayFilename);
+            return -1;
+        }
+        
+        if (replayStartFrame)
+        {
+            seekReplay(&replay, replayStartFrame);
+        }
+    }
+    else
+    {
+        const char* devName = "/dev/video0";
+        if (!startCapturing(&permanentArena,
+                            &captureState,
+                            CAPTURE_BUFFER_COUNT, 
+                            devName,
+                            captureConfig))
+        {
+            printf("Could not initialize capture\n");
+            return -1;
+        }
+    }
+    
+    // NOTE(jan): everything downstream works with what the driver agreed
+    // to, debug frames are sent at full capture size
+    captureConfig = captureState.config;
+    i32 frameWidth = captureConfig.width;
+    i32 frameHeight = captureConfig.height;
+    
+    // NOTE(jan): intrinsics only fit the size they were calibrated at
+    char calibrationFilePath[100];
+    snprintf(calibrationFilePath,
+             100,
+             "calibrations/spotter_%ix%i.calib", 
+             frameWidth, frameHeight);
+    
     Calibration calibration = {};
     ReadFileResult calibrationFile;
     Calibration* calibrationPtr = 0;
@@ -105,32 +357,32 @@ i32 main(i32 argc, const char* argv[])
         freeFileMemory(&calibrationFile);
     }
     
-    void* baseAddress = (void*)terabytes(2);
-    u64 permanentMemorySize = megabytes(50);
-    u64 flushMemorySize = megabytes(50);
-    u64 totalMemorySize = permanentMemorySize + flushMemorySize;
-    u8* systemMemory = (u8*)mmap(baseAddress, 
-                                 totalMemorySize,
-                                 PROT_READ | PROT_WRITE,
-                                 MAP_ANON | MAP_PRIVATE,
-                                 -1, 0);
+    ExtractionPool extractionPool;
+    startExtractionPool(&permanentArena,
+                        &extractionPool,
+                        frameWidth,
+                        frameHeight,
+                        extractionThreadCount);
+    setExtractionTiles(&extractionPool, useExtractionTiles);
     
-    MemoryArena permanentArena, flushArena;
-    initMemoryArena(&permanentArena, permanentMemorySize,
-                    (systemMemory));
-    initMemoryArena(&flushArena, flushMemorySize,
-                    (systemMemory+permanentMemorySize));
+    PoseEstimator poseEstimator;
+    startPoseEstimator(&permanentArena,
+                       &poseEstimator,
+                       frameWidth,
+                       frameHeight);
     
-    CaptureState captureState = {};
-    const char* devName = "/dev/video0";
-    if (!startCapturing(&permanentArena,
-                        &captureState,
-                        CAPTURE_BUFFER_COUNT, 
-                        devName))
-    {
-        printf("Could not initialize capture\n");
-        return -1;
-    }
+    // NOTE(jan): yuyv frames are recorded as their luma plane, which
+    // lives in application memory and has to be copied, as do replayed
+    // frames, which are no capture buffers
+    Recorder recorder;
+    startRecorder(&permanentArena,
+                  &recorder,
+                  &captureState,
+                  frameWidth,
+                  frameHeight,
+                  captureConfig.bytesPerPixel != 1 ||
+                  captureState.backend == CaptureBackend_Replay);
+    RecorderStats lastRecorderStats = {};
     
     I2CBus brightPi = {};
     initI2C(&brightPi);
@@ -139,10 +391,18 @@ i32 main(i32 argc, const char* argv[])
     ApplicationState applicationState = {};
     initApplication(&applicationState,
                     &permanentArena,
-                    CAPTURE_FRAME_WIDTH,
-                    CAPTURE_FRAME_HEIGHT,
+                    frameWidth,
+                    frameHeight,
                     calibrationPtr,
                     localIp);
+    applicationState.adaptiveThreshold = adaptiveThreshold;
+    if (learnStaticMaskAtStart)
+    {
+        startStaticMaskLearning(&applicationState);
+    }
+    applicationState.hasTrackingVolume = hasTrackingVolume;
+    applicationState.trackingVolumeMin = trackingVolumeMin;
+    applicationState.trackingVolumeMax = trackingVolumeMax;
     
     if (loadPoseFromFile)
     {
@@ -163,16 +423,33 @@ i32 main(i32 argc, const char* argv[])
     TransmissionState senderTransmissionState = {};
     TransmissionState receiverTransmissionState = {};
     initTransmissionState(&senderTransmissionState);
-    initTransmissionState(&receiverTransmissionState);
+    initTransmissionState(&receiverTransmissionState,
+                          &senderTransmissionState);
     
     openPushTransmissionChannel(&senderTransmissionState,
                                 serverIp,
                                 portNumber,
-                                0);
+                                0,
+                                transport);
     
     openSubscriberTransmissionChannel(&receiverTransmissionState,
                                       serverIp,
-                                      handshakePortNumber);
+                                      handshakePortNumber,
+                                      transport);
+    
+    // NOTE(jan): from here on only the sender thread touches the push socket
+    SendQueue sendQueue;
+    startSendQueue(&permanentArena,
+                   &sendQueue,
+                   &senderTransmissionState,
+                   frameWidth * frameHeight);
+    SendQueueStats lastSendQueueStats = {};
+    u64 timeOfLastSendQueueStats = getWallclockTimeInMs();
+    
+    // NOTE(jan): averaged over the frames that went through the tile
+    // pass and printed with the send queue stats
+    r32 skippedTileFractionSum = 0.0f;
+    u32 tiledFrameCount = 0;
     
     usleep(1000*1000);
     
@@ -182,14 +459,13 @@ i32 main(i32 argc, const char* argv[])
              arrayLength(helloPayload.ip),
              "%s",
              localIp.c_str());
-    helloPayload.frameWidth = WINDOW_WIDTH;
-    helloPayload.frameHeight = WINDOW_HEIGHT;
-    sendMessage(&flushArena,
-                &senderTransmissionState,
-                MessageType_HelloReq,
-                &helloPayload,
-                sizeof(helloPayload),
-                0);
+    helloPayload.frameWidth = frameWidth;
+    helloPayload.frameHeight = frameHeight;
+    queueMessage(&sendQueue,
+                 MessageType_HelloReq,
+                 &helloPayload,
+                 sizeof(helloPayload),
+                 0);
     
     printf("Handshake sent\n");
     
@@ -229,7 +505,8 @@ i32 main(i32 argc, const char* argv[])
                 {
                     CommandType commandType = *((CommandType*)msg.data);
                     
-                    if (commandType != 1)
+                    if (commandType != CommandType_GrabFrame &&
+                        commandType != CommandType_MarkerPrediction)
                     {
                         printf("Command received %i\n", commandType);
                     }
@@ -242,8 +519,10 @@ i32 main(i32 argc, const char* argv[])
                     {
                         switchLEDsOff(&brightPi);
                         switchVisableOn(&brightPi);
-                        applicationState.poseEstimationIndex = 0;
+                        restartPoseEstimation(&poseEstimator,
+                                              &applicationState.calibration);
                         applicationState.status = ApplicationStatus_EstimatingPose;
+                        applicationState.captureCropOutdated = 1;
                     }
                     else if (commandType == CommandType_SendGrayscale)
                     {
@@ -267,27 +546,91 @@ i32 main(i32 argc, const char* argv[])
                         getTimeString(timeString, 100);
                         char filename[100];
                         snprintf(filename, 100, "debug_frames_%ix%i_%s.spot", 
-                                 CAPTURE_FRAME_WIDTH,
-                                 CAPTURE_FRAME_HEIGHT,
+                                 frameWidth,
+                                 frameHeight,
                                  timeString);
                         printf("saving frames to file %s\n", filename);
-                        captureState.saveFileDescriptor = openFileForWriting(filename);
+                        openRecording(&recorder,
+                                      filename,
+                                      frameWidth,
+                                      frameHeight,
+                                      recordingEncoding,
+                                      recordingThreshold);
                     }
                     else if (commandType == CommandType_BinarizationThreshold)
                     {
                         u8 threshold = *(((u8*)msg.data) + sizeof(commandType));
                         printf("threshold: %i\n", threshold);
                         applicationState.binarizationThreshold = threshold;
+                        // NOTE(jan): a threshold set by hand stays
+                        applicationState.adaptiveThreshold.targetMarkerCount = 0;
                         printf("Threshold set\n");
                     }
+                    else if (commandType == CommandType_LearnStaticMask)
+                    {
+                        startStaticMaskLearning(&applicationState);
+                    }
+                    else if (commandType == CommandType_AdaptiveThreshold)
+                    {
+                        if (msg.header.payloadSize >=
+                            sizeof(commandType) + sizeof(AdaptiveThresholdConfig))
+                        {
+                            AdaptiveThresholdConfig* config =
+                                (AdaptiveThresholdConfig*)(((u8*)msg.data) + sizeof(commandType));
+                            applicationState.adaptiveThreshold = *config;
+                            applicationState.thresholdCorrectionFrames = 0;
+                            printf("Adapting threshold to %u markers between %i and %i\n",
+                                   config->targetMarkerCount,
+                                   config->minThreshold,
+                                   config->maxThreshold);
+                        }
+                    }
                     else if (commandType == CommandType_StopSystem)
                     {
                         applicationState.status = ApplicationStatus_Exiting;
                     }
+                    else if (commandType == CommandType_MarkerPrediction)
+                    {
+                        if (msg.header.payloadSize >= 
+                            sizeof(commandType) + sizeof(MarkerPrediction))
+                        {
+                            MarkerPrediction* prediction = 
+                                (MarkerPrediction*)(((u8*)msg.data) + sizeof(commandType));
+                            applicationState.markerPrediction = *prediction;
+                            applicationState.markerPrediction.markerCount =
+                                min(prediction->markerCount, MARKER_PREDICTION_MAX_COUNT);
+                            applicationState.markerPredictionAge = 0;
+                        }
+                    }
                 } break;
             }
         }
         
+        // NOTE(jan): no frame is held here, so the capture can be
+        // restarted with the new crop
+        if (applicationState.captureCropOutdated)
+        {
+            updateCaptureCropRect(&applicationState);
+            // NOTE(jan): pinned buffers have to be back first
+            waitForRecorder(&recorder);
+            CaptureCropResult cropResult =
+                setCaptureCrop(&captureState,
+                               applicationState.cropX,
+                               applicationState.cropY,
+                               applicationState.cropWidth,
+                               applicationState.cropHeight);
+            applicationState.captureCropOutdated = 0;
+            
+            // NOTE(jan): without a stream there won't be any more frames
+            if (cropResult == CaptureCropResult_Failed)
+            {
+                printf("Capture is gone, exiting\n");
+                applicationState.status = ApplicationStatus_Exiting;
+                flushMemory(&flushArena);
+                continue;
+            }
+        }
+        
         u64 endMessageHandlingTime = getWallclockTimeInMs();
         u64 messageHandlingTime = endMessageHandlingTime - startMessageHandlingTime;
         
@@ -302,36 +645,50 @@ i32 main(i32 argc, const char* argv[])
             
             Frame* frame = 0;
             
-            if (readFramesFromFile)
-            {
-                usleep(33000);
-                *frame = initializeFrame(&flushArena,
-                                         CAPTURE_FRAME_WIDTH, CAPTURE_FRAME_HEIGHT,
-                                         2);
-                readFromFileResult(&loadedFrames,
-                                   frame->memory,
-                                   frame->pitch * frame->height);
-            }
-            else
+            // NOTE(jan): the capture thread keeps the newest frame
+            // ready, try again with the next pass if there is none
+            if (!readFrame(&captureState, &frame))
             {
-#if 0
-                // TODO(jan): rethink this
-                // NOTE(jan): always grab frames to prevent them from queing up
-                while (!(readFrame(&captureState, &frame))) 
+                flushMemory(&flushArena);
+                if (captureState.backend == CaptureBackend_Replay &&
+                    replay.finished)
                 {
-                    if (errno != EAGAIN)
-                    {
-                        printErrno();
-                        return -1;
-                    }
-                    else
-                    {
-                        usleep(10);
-                    }
+                    applicationState.status = ApplicationStatus_Exiting;
                 }
-#else
-                readFrame(&captureState, &frame);
-#endif
+                continue;
+            }
+            
+            // NOTE(jan): blob extraction and pose estimation work on
+            // the luma plane only
+            if (frame->bytesPerPixel == 2)
+            {
+                Frame* grayscaleFrame = &applicationState.grayscaleFrame;
+                grayscaleFrame->width = frame->width;
+                grayscaleFrame->height = frame->height;
+                grayscaleFrame->size = grayscaleFrame->pitch * frame->height;
+                grayscaleFrame->originX = frame->originX;
+                grayscaleFrame->originY = frame->originY;
+                CV_convertCaptureFrameToGrayscale(frame, grayscaleFrame);
+                grayscaleFrame->timestampUs = frame->timestampUs;
+                grayscaleFrame->sequence = frame->sequence;
+                frame = grayscaleFrame;
+            }
+            
+            // NOTE(jan): if the driver could not crop, the frame is
+            // cropped here, which at least saves scanning the rest
+            Frame* capturedFrame = frame;
+            Frame croppedFrame = {};
+            if (frame->originX != applicationState.cropX ||
+                frame->originY != applicationState.cropY ||
+                frame->width != applicationState.cropWidth ||
+                frame->height != applicationState.cropHeight)
+            {
+                croppedFrame = cropFrame(frame,
+                                         applicationState.cropX,
+                                         applicationState.cropY,
+                                         applicationState.cropWidth,
+                                         applicationState.cropHeight);
+                frame = &croppedFrame;
             }
             
             u64 endCaptureTime = getWallclockTimeInMs();
@@ -343,7 +700,7 @@ i32 main(i32 argc, const char* argv[])
                 senderTransmissionState.sendBufferType != SendBufferType_None)
             {
                 Frame downsampleFrame = initializeFrame(&flushArena,
-                                                        WINDOW_WIDTH, WINDOW_HEIGHT,
+                                                        frame->width, frame->height,
                                                         1);
                 
                 if (senderTransmissionState.sendBufferType == SendBufferType_Grayscale)
@@ -353,15 +710,18 @@ i32 main(i32 argc, const char* argv[])
                 }
                 else if (senderTransmissionState.sendBufferType == SendBufferType_Binarized)
                 {
+                    Frame binarizedFrame = applicationState.binarizedFrame;
+                    binarizedFrame.width = frame->width;
+                    binarizedFrame.height = frame->height;
                     CV_binarize(frame,
-                                &applicationState.binarizedFrame,
+                                &binarizedFrame,
                                 applicationState.binarizationThreshold);
-                    CV_resizeFrame(&applicationState.binarizedFrame,
+                    CV_resizeFrame(&binarizedFrame,
                                    &downsampleFrame);
                 }
                 
                 Frame transmissionFrame = initializeFrame(&flushArena,
-                                                          WINDOW_WIDTH, WINDOW_HEIGHT,
+                                                          frame->width, frame->height,
                                                           1);
                 transmissionFrame.size = 0;
                 stbi_write_jpg_to_func(&writeToFrame,
@@ -371,12 +731,11 @@ i32 main(i32 argc, const char* argv[])
                                        1,
                                        downsampleFrame.memory,
                                        10);
-                sendMessage(&flushArena,
-                            &senderTransmissionState,
-                            MessageType_DebugFrame,
-                            transmissionFrame.memory,
-                            transmissionFrame.size,
-                            senderTransmissionState.spotterID);
+                queueMessage(&sendQueue,
+                             MessageType_DebugFrame,
+                             transmissionFrame.memory,
+                             transmissionFrame.size,
+                             senderTransmissionState.spotterID);
             }
             
             u64 endFrameSendingTime = getWallclockTimeInMs();
@@ -386,6 +745,7 @@ i32 main(i32 argc, const char* argv[])
             
             void* payload = 0;
             i32 payloadSize = 0;
+            u8 extractionThreshold = applicationState.binarizationThreshold;
             
             switch (applicationState.status)
             {
@@ -394,150 +754,194 @@ i32 main(i32 argc, const char* argv[])
                     {
                         applicationState.poseLoadedFromFile = 0;
                         
-                        sendMessage(&flushArena,
-                                    &senderTransmissionState, 
-                                    MessageType_DebugCameraPose,
-                                    &applicationState.cTw.inv,
-                                    sizeof(M4x4),
-                                    senderTransmissionState.spotterID);
+                        queueMessage(&sendQueue,
+                                     MessageType_DebugCameraPose,
+                                     &applicationState.cTw.inv,
+                                     sizeof(M4x4),
+                                     senderTransmissionState.spotterID);
                         
                         applicationState.status = ApplicationStatus_Detecting;
+                        applicationState.captureCropOutdated = 1;
                         
                         switchLEDsOff(&brightPi);
                         switchIROn(&brightPi);
                     }
                     else
                     {
-                        if (applicationState.poseEstimationIndex == 0 || 
-                            (applicationState.timeOfLastCapture + POSE_ESTIMATION_TIMEOUT_MS) < getWallclockTimeInMs())
+                        // NOTE(jan): the worker takes the frame if it is
+                        // idle, the preview keeps streaming meanwhile
+                        submitPoseFrame(&poseEstimator, frame);
+                        
+                        M4x4inv cTw;
+                        if (getEstimatedPose(&poseEstimator, &cTw))
                         {
-                            M4x4inv cTw = {};
-                            bool32 poseEstimated = CV_estimatePose(&flushArena,
-                                                                   &applicationState.calibration,
-                                                                   frame,
-                                                                   &cTw);
+                            applicationState.cTw = cTw;
                             
-                            if (poseEstimated)
-                            {
-                                applicationState.poseEstimations[applicationState.poseEstimationIndex]
-                                    = cTw;
-                                applicationState.poseEstimationIndex++;
-                                
-                                printf("Pose estimation %i\n", applicationState.poseEstimationIndex);
-                                printM4x4(&cTw.inv);
-                                printf("-------------------\n");
-                                
-                                if (applicationState.poseEstimationIndex >= POSE_ESTIMATION_COUNT)
-                                {
-                                    M4x4inv cTw = {};
-                                    
-                                    r32 oneOverPoseEstimationCount = 1.0f / POSE_ESTIMATION_COUNT;
-                                    
-                                    for (i32 i = 0;
-                                         i < POSE_ESTIMATION_COUNT;
-                                         i++)
-                                    {
-                                        M4x4inv* m = &applicationState.poseEstimations[i];
-                                        
-                                        for (i32 col = 0;
-                                             col < 4;
-                                             col++)
-                                        {
-                                            for (i32 row = 0;
-                                                 row < 4;
-                                                 row++)
-                                            {
-                                                cTw.fwd.e[col][row] += m->fwd.e[col][row];
-                                                cTw.inv.e[col][row] += m->inv.e[col][row];
-                                            }
-                                        }
-                                    }
-                                    
-                                    for (i32 col = 0;
-                                         col < 4;
-                                         col++)
-                                    {
-                                        for (i32 row = 0;
-                                             row < 4;
-                                             row++)
-                                        {
-                                            cTw.fwd.e[col][row] *= oneOverPoseEstimationCount;
-                                            cTw.inv.e[col][row] *= oneOverPoseEstimationCount;
-                                        }
-                                    }
-                                    
-                                    applicationState.cTw = cTw;
-                                    
-                                    printf("Pose estimated with chessboard of size %f\n",
-                                           CHESSBOARD_FIELD_EDGE_IN_CM);
-                                    printM4x4(&applicationState.cTw.fwd);
-                                    printf("-------------------\n");
-                                    
-                                    V4 cC = v4(0.0f, 0.0f, 0.0f, 1.0f);
-                                    V4 wC = multM4x4V4(applicationState.cTw.inv,
-                                                       cC);
-                                    applicationState.cameraOrigin = v3(wC.x, wC.y, wC.z);
-                                    
-                                    printf("Sending camera pose: \n");
-                                    printM4x4(&applicationState.cTw.inv);
-                                    
-                                    printf("-------------------\n");
-                                    sendMessage(&flushArena,
-                                                &senderTransmissionState, 
-                                                MessageType_DebugCameraPose,
-                                                &applicationState.cTw.inv,
-                                                sizeof(M4x4),
-                                                senderTransmissionState.spotterID);
-                                    
-                                    writeToFile("pose.spot",
-                                                &applicationState.cTw,
-                                                sizeof(applicationState.cTw));
-                                    
-                                    applicationState.status = ApplicationStatus_Detecting;
-                                    
-                                    switchLEDsOff(&brightPi);
-                                    switchIROn(&brightPi);
-                                    
-                                    applicationState.timeOfLastCapture = getWallclockTimeInMs();
-                                }
-                            }
+                            printf("Pose estimated with chessboard of size %f\n",
+                                   CHESSBOARD_FIELD_EDGE_IN_CM);
+                            printM4x4(&applicationState.cTw.fwd);
+                            printf("-------------------\n");
+                            
+                            V4 cC = v4(0.0f, 0.0f, 0.0f, 1.0f);
+                            V4 wC = multM4x4V4(applicationState.cTw.inv,
+                                               cC);
+                            applicationState.cameraOrigin = v3(wC.x, wC.y, wC.z);
+                            
+                            printf("Sending camera pose: \n");
+                            printM4x4(&applicationState.cTw.inv);
+                            
+                            printf("-------------------\n");
+                            queueMessage(&sendQueue,
+                                         MessageType_DebugCameraPose,
+                                         &applicationState.cTw.inv,
+                                         sizeof(M4x4),
+                                         senderTransmissionState.spotterID);
+                            
+                            writeToFile("pose.spot",
+                                        &applicationState.cTw,
+                                        sizeof(applicationState.cTw));
+                            
+                            applicationState.status = ApplicationStatus_Detecting;
+                            applicationState.captureCropOutdated = 1;
+                            
+                            switchLEDsOff(&brightPi);
+                            switchIROn(&brightPi);
                         }
                     }
                 } break;
                 
                 case ApplicationStatus_Detecting: {
+#if USE_CV_ANALYZATION
                     BlobVector blobVector = CV_detectBlobs(&flushArena,
                                                            frame,
                                                            applicationState.binarizationThreshold);
+#else
+                    // NOTE(jan): the static mask is learned from
+                    // everything there is to see
+                    bool32 learningStaticMask = applicationState.learningStaticMask;
+                    bool32 useStaticMask =
+                        applicationState.hasStaticMask && !learningStaticMask;
+                    bool32 useRoi = 
+                        !learningStaticMask &&
+                        applicationState.markerPrediction.markerCount &&
+                        applicationState.markerPredictionAge <= ROI_MAX_PREDICTION_AGE &&
+                        applicationState.framesSinceFullScan < ROI_FULL_SCAN_INTERVAL;
+                    
+                    i32 expectedMarkerCount = 0;
+                    if (useRoi)
+                    {
+                        expectedMarkerCount = buildMarkerRoiTileMask(&applicationState,
+                                                                     frame);
+                    }
+                    if (useStaticMask)
+                    {
+                        maskStaticTiles(&applicationState, frame, useRoi);
+                    }
+                    if (useRoi || useStaticMask)
+                    {
+                        setExtractionRegionOfInterest(&extractionPool,
+                                                      applicationState.roiTileMask);
+                    }
+                    
+                    BlobVector blobVector = detectBlobs(&flushArena,
+                                                        &extractionPool,
+                                                        frame,
+                                                        applicationState.binarizationThreshold);
+                    if (extractionPool.merged.tileCount)
+                    {
+                        skippedTileFractionSum +=
+                            getSkippedTileFraction(&extractionPool.merged);
+                        tiledFrameCount++;
+                    }
+                    
+                    // NOTE(jan): a marker went missing, it could be
+                    // anywhere, so look at the whole frame again
+                    if (useRoi && blobVector.count < expectedMarkerCount)
+                    {
+                        useRoi = 0;
+                        if (useStaticMask)
+                        {
+                            maskStaticTiles(&applicationState, frame, 0);
+                        }
+                        else
+                        {
+                            setExtractionRegionOfInterest(&extractionPool, 0);
+                        }
+                        blobVector = detectBlobs(&flushArena,
+                                                 &extractionPool,
+                                                 frame,
+                                                 applicationState.binarizationThreshold);
+                    }
+                    setExtractionRegionOfInterest(&extractionPool, 0);
+                    
+                    if (learningStaticMask)
+                    {
+                        learnStaticMask(&applicationState,
+                                        extractionPool.merged.blobs,
+                                        extractionPool.merged.blobCount,
+                                        frame);
+                    }
+                    
+                    if (useRoi)
+                    {
+                        applicationState.framesSinceFullScan++;
+                    }
+                    else
+                    {
+                        applicationState.framesSinceFullScan = 0;
+                    }
+#endif
+#if USE_CV_ANALYZATION
+                    adaptBinarizationThreshold(&applicationState,
+                                               0, 0,
+                                               blobVector.count);
+#else
+                    adaptBinarizationThreshold(&applicationState,
+                                               extractionPool.merged.histogram,
+                                               extractionPool.merged.histogramSampleCount,
+                                               blobVector.count);
+#endif
+                    
                     i32 pointCount = blobVector.count;
                     if (pointCount)
                     {
                         //printf("%i blobs detected\n", pointCount);
                         
-                        payloadSize = pointCount * sizeof(Ray);
+                        payloadSize = sizeof(PayloadHeader) + pointCount * sizeof(Ray);
+                        if (blobVector.qualities)
+                        {
+                            payloadSize += pointCount * sizeof(RayQuality);
+                        }
                         payload = pushSize(&flushArena, payloadSize);
+                        ((PayloadHeader*)payload)->rayCount = pointCount;
                         
-                        Ray* rays = (Ray*)payload;
-                        Ray* rayPtr = rays;
-                        
-                        V2* undistPoints =
-                            (V2*)pushSize(&flushArena, sizeof(V2) * pointCount);
+                        Ray* rays = (Ray*)((u8*)payload + sizeof(PayloadHeader));
                         
-                        CV_undistortPoints(blobVector.blobs, 
-                                           undistPoints, 
-                                           pointCount, 
-                                           &applicationState.calibration);
+                        CV_updateRayLookupTable(&flushArena,
+                                                &applicationState.rayLookupTable,
+                                                &applicationState.calibration,
+                                                &applicationState.cTw);
                         
-                        V2* pointPtr = undistPoints;
                         for (i32 i = 0; i < pointCount; i++)
                         {
-                            Ray ray = castCameraToWorld(pointPtr,
-                                                        &applicationState.cameraOrigin,
-                                                        &applicationState.cTw.inv,
-                                                        &applicationState.calibration);
-                            *rayPtr = ray;
-                            rayPtr++;
-                            pointPtr++;
+                            rays[i] = castPixelToWorld(&applicationState.rayLookupTable,
+                                                       blobVector.blobs[i]);
+                        }
+                        
+                        if (blobVector.qualities)
+                        {
+                            RayQuality* rayQualities = (RayQuality*)(rays + pointCount);
+                            for (i32 i = 0; i < pointCount; i++)
+                            {
+                                BlobQuality* quality = &blobVector.qualities[i];
+                                RayQuality* rayQuality = &rayQualities[i];
+                                rayQuality->area = (u16)min(quality->area, 0xFFFF);
+                                rayQuality->peak = quality->peak;
+                                rayQuality->circularity =
+                                    (u8)(quality->circularity * 255.0f + 0.5f);
+                                rayQuality->centroidUncertainty =
+                                    quality->centroidUncertainty;
+                            }
                         }
                     }
                 } break;
@@ -546,32 +950,84 @@ i32 main(i32 argc, const char* argv[])
                 } break;
             }
             
-            sendMessage(&flushArena,
-                        &senderTransmissionState,
-                        MessageType_Payload,
-                        payload, payloadSize,
-                        senderTransmissionState.spotterID);
+            // NOTE(jan): frames without rays still tell the beholder
+            // about their exposure
+            if (!payload)
+            {
+                payloadSize = sizeof(PayloadHeader);
+                payload = pushStruct(&flushArena, PayloadHeader);
+                *((PayloadHeader*)payload) = {};
+            }
+            
+            PayloadHeader* payloadHeader = (PayloadHeader*)payload;
+            payloadHeader->exposureTimestampUs = frame->timestampUs;
+            payloadHeader->frameSequence = frame->sequence;
+            payloadHeader->binarizationThreshold = extractionThreshold;
+            payloadHeader->sentTimestampUs = getMonotonicTimeInUs();
+            
+            queueMessage(&sendQueue,
+                         MessageType_Payload,
+                         payload, payloadSize,
+                         senderTransmissionState.spotterID);
             
             applicationState.grabFrame = 0;
+            applicationState.markerPredictionAge++;
             
             u64 endHandlingTime = getWallclockTimeInMs();
             handlingTime = endHandlingTime - startHandlingTime;
             
             if (saveFramesToFile)
             {
-                writeToFile(captureState.saveFileDescriptor,
-                            frame->memory,
-                            frame->pitch * frame->height);
+                recordFrame(&recorder, capturedFrame);
             }
             
-            if (!readFramesFromFile)
-            {
-                requeueBuffer(&captureState);
-            }
+            requeueBuffer(&captureState);
         }
         
         u64 endTime = getWallclockTimeInMs();
         u64 dT = endTime - startTime;
+        
+        if (endTime > timeOfLastSendQueueStats + SEND_QUEUE_STATS_INTERVAL_MS)
+        {
+            SendQueueStats sendQueueStats = getSendQueueStats(&sendQueue);
+            if (memcmp(sendQueueStats.dropped, 
+                       lastSendQueueStats.dropped,
+                       sizeof(sendQueueStats.dropped)))
+            {
+                printSendQueueStats(&sendQueueStats);
+            }
+            
+            lastSendQueueStats = sendQueueStats;
+            timeOfLastSendQueueStats = endTime;
+            
+            if (tiledFrameCount)
+            {
+                printf("Extraction tiles skipped: %.1f%% (%u frames)\n",
+                       100.0f * skippedTileFractionSum / (r32)tiledFrameCount,
+                       tiledFrameCount);
+                skippedTileFractionSum = 0.0f;
+                tiledFrameCount = 0;
+            }
+            
+            if (saveFramesToFile)
+            {
+                RecorderStats recorderStats = getRecorderStats(&recorder);
+                if (recorderStats.recordedCount != lastRecorderStats.recordedCount ||
+                    recorderStats.droppedCount != lastRecorderStats.droppedCount)
+                {
+                    printRecorderStats(&recorderStats);
+                }
+                lastRecorderStats = recorderStats;
+                
+                // NOTE(jan): the writer takes no more frames after a
+                // failed write, the beholder has to start a new recording
+                if (recorderStats.writeFailed)
+                {
+                    closeRecording(&recorder);
+                    saveFramesToFile = 0;
+                }
+            }
+        }
 #if 0
         printf("dT: %" PRIu64 "\n"
                "\tmessage:  %" PRIu64 "\n"
@@ -588,8 +1044,18 @@ i32 main(i32 argc, const char* argv[])
         flushMemory(&flushArena);
     }
     
+    stopExtractionPool(&extractionPool);
+    stopPoseEstimator(&poseEstimator);
+    stopRecorder(&recorder);
+    
+    stopSendQueue(&sendQueue);
+    SendQueueStats sendQueueStats = getSendQueueStats(&sendQueue);
+    printSendQueueStats(&sendQueueStats);
+    
     closeTransmissionChannel(&senderTransmissionState);
     closeTransmissionChannel(&receiverTransmissionState);
+    destroyTransmissionState(&receiverTransmissionState);
+    destroyTransmissionState(&senderTransmissionState);
     stopCapturing(&captureState);
     
     return 0;
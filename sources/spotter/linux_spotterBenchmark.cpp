@@ -0,0 +1,219 @@
+#define CHESSBOARD_INNER_COLUMN_COUNT 8
+#define CHESSBOARD_INNER_ROW_COUNT 11
+#define CHESSBOARD_FIELD_EDGE_IN_CM 12.1f
+
+#define BENCHMARK_DEFAULT_THRESHOLD 180
+#define BENCHMARK_DEFAULT_REPEAT_COUNT 3
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "../include/platform.h"
+#include "../include/math.h"
+#include "s_capture.cpp"
+#include "s_recording.cpp"
+#include "s_replay.cpp"
+#include "s_analyzation.cpp"
+#include "s_extraction.cpp"
+
+// NOTE(jan): runs the blob detection paths over the frames of a .spot
+// recording, e.g. debug_frames_1640x1232_<time>.spot, and prints how long
+// each of them takes per frame. Decoding the frames is not timed.
+
+enum BenchmarkMode
+{
+    BenchmarkMode_OpenCV,
+    BenchmarkMode_FullFrame,
+    BenchmarkMode_Tiles,
+    BenchmarkMode_TilesParallel,
+    BenchmarkMode_Count
+};
+
+static const char* benchmarkModeNames[BenchmarkMode_Count] = {
+    "opencv blob detector",
+    "extractor, full frame",
+    "extractor, tiles",
+    "extractor, tiles, parallel"
+};
+
+struct BenchmarkResult
+{
+    u64 durationUs;
+    u64 blobCount;
+    r32 skippedTileFractionSum;
+};
+
+i32 main(i32 argc, const char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <frames.spot> [-s <width> <height>] [-t <threshold>] "
+               "[-j <threads>] [-n <repeats>]\n",
+               argv[0]);
+        return 1;
+    }
+    
+    const char* filename = argv[1];
+    i32 width = CAPTURE_FRAME_WIDTH;
+    i32 height = CAPTURE_FRAME_HEIGHT;
+    i32 threshold = BENCHMARK_DEFAULT_THRESHOLD;
+    i32 threadCount = EXTRACTION_THREAD_COUNT;
+    i32 repeatCount = BENCHMARK_DEFAULT_REPEAT_COUNT;
+    
+    // NOTE(jan): old recordings without a header only have their frame
+    // size in the file name
+    getRecordingFrameSizeFromName(filename, &width, &height);
+    
+    for (i32 i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            width = atoi(argv[i + 1]);
+            height = atoi(argv[i + 2]);
+            i += 2;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-t") == 0)
+        {
+            threshold = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            threadCount = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        
+        if (strcmp(argv[i], "-n") == 0)
+        {
+            repeatCount = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+    }
+    
+    MappedFile frames = {};
+    if (!mapEntireFile(filename, &frames))
+    {
+        return 1;
+    }
+    
+    RecordingReader reader;
+    if (!openRecordingReader(&reader,
+                             frames.content,
+                             frames.contentSize,
+                             width,
+                             height))
+    {
+        return 1;
+    }
+    width = reader.header.width;
+    height = reader.header.height;
+    
+    void* baseAddress = (void*)terabytes(2);
+    u64 permanentMemorySize = megabytes(50);
+    u64 flushMemorySize = megabytes(50);
+    u8* systemMemory = (u8*)mmap(baseAddress,
+                                 permanentMemorySize + flushMemorySize,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_ANON | MAP_PRIVATE,
+                                 -1, 0);
+    
+    MemoryArena permanentArena, flushArena;
+    initMemoryArena(&permanentArena, permanentMemorySize,
+                    (systemMemory));
+    initMemoryArena(&flushArena, flushMemorySize,
+                    (systemMemory + permanentMemorySize));
+    
+    Frame frame = initializeFrame(&permanentArena, width, height, 1);
+    
+    i32 frameCount = 0;
+    while (readNextRecordingFrame(&reader, &frame))
+    {
+        frameCount++;
+    }
+    printf("%i frames of %i x %i, threshold %i, %i threads\n",
+           frameCount, width, height, threshold, threadCount);
+    if (!frameCount)
+    {
+        return 1;
+    }
+    
+    ExtractionPool serialPool;
+    startExtractionPool(&permanentArena, &serialPool, width, height, 1);
+    ExtractionPool parallelPool;
+    startExtractionPool(&permanentArena, &parallelPool, width, height, threadCount);
+    
+    BenchmarkResult results[BenchmarkMode_Count] = {};
+    
+    for (i32 repeat = 0; repeat < repeatCount; repeat++)
+    {
+        seekRecordingFrame(&reader, 0);
+        for (i32 frameIndex = 0; frameIndex < frameCount; frameIndex++)
+        {
+            frame.width = width;
+            frame.height = height;
+            readNextRecordingFrame(&reader, &frame);
+            
+            for (i32 mode = 0; mode < BenchmarkMode_Count; mode++)
+            {
+                ExtractionPool* pool = &serialPool;
+                if (mode == BenchmarkMode_TilesParallel)
+                {
+                    pool = &parallelPool;
+                }
+                setExtractionTiles(pool, mode != BenchmarkMode_FullFrame);
+                
+                u64 startTime = getMonotonicTimeInUs();
+                
+                BlobVector blobs;
+                if (mode == BenchmarkMode_OpenCV)
+                {
+                    blobs = CV_detectBlobs(&flushArena, &frame, threshold);
+                }
+                else
+                {
+                    blobs = detectBlobs(&flushArena, pool, &frame, threshold);
+                }
+                
+                BenchmarkResult* result = &results[mode];
+                result->durationUs += getMonotonicTimeInUs() - startTime;
+                result->blobCount += blobs.count;
+                result->skippedTileFractionSum +=
+                    getSkippedTileFraction(&pool->merged);
+                
+                flushMemory(&flushArena);
+            }
+        }
+    }
+    
+    r32 processedFrameCount = (r32)(frameCount * repeatCount);
+    r32 baseline = results[BenchmarkMode_OpenCV].durationUs / processedFrameCount;
+    for (i32 mode = 0; mode < BenchmarkMode_Count; mode++)
+    {
+        BenchmarkResult* result = &results[mode];
+        r32 frameTime = result->durationUs / processedFrameCount;
+        printf("%-28s %8.3f ms/frame  %6.2fx  %6.2f blobs/frame",
+               benchmarkModeNames[mode],
+               frameTime / 1000.0f,
+               baseline / frameTime,
+               result->blobCount / processedFrameCount);
+        if (mode == BenchmarkMode_Tiles || mode == BenchmarkMode_TilesParallel)
+        {
+            printf("  %5.1f%% tiles skipped",
+                   100.0f * result->skippedTileFractionSum / processedFrameCount);
+        }
+        printf("\n");
+    }
+    
+    stopExtractionPool(&parallelPool);
+    stopExtractionPool(&serialPool);
+    unmapFile(&frames);
+    
+    return 0;
+}
@@ -62,6 +62,119 @@ static Ray castCameraToWorld(V2* cameraPoint,
     return result;
 }
 
+static void initRayLookupTable(MemoryArena* arena,
+                               RayLookupTable* table,
+                               i32 width,
+                               i32 height)
+{
+    *table = {};
+    
+    table->width = width;
+    table->height = height;
+    table->columnCount = (width - 1) / RAY_LOOKUP_STEP + 2;
+    table->rowCount = (height - 1) / RAY_LOOKUP_STEP + 2;
+    table->directions = (V3*)pushSize(arena,
+                                      sizeof(V3) *
+                                      table->columnCount *
+                                      table->rowCount);
+}
+
+// NOTE(jan): undistorts all grid nodes with one call into opencv, only if
+// the calibration or pose differs from the one the table was built with
+static void CV_updateRayLookupTable(MemoryArena* arena,
+                                    RayLookupTable* table,
+                                    Calibration* calibration,
+                                    M4x4inv* cTw)
+{
+    if (table->isValid &&
+        memcmp(&table->calibration, calibration, sizeof(Calibration)) == 0 &&
+        memcmp(&table->wTc, &cTw->inv, sizeof(M4x4)) == 0)
+    {
+        return;
+    }
+    
+    TemporaryMemory tempMem = beginTemporaryMemory(arena);
+    
+    i32 nodeCount = table->columnCount * table->rowCount;
+    V2* nodePoints = (V2*)pushSize(arena, sizeof(V2) * nodeCount);
+    V2* undistPoints = (V2*)pushSize(arena, sizeof(V2) * nodeCount);
+    
+    V2* nodePtr = nodePoints;
+    for (i32 row = 0; row < table->rowCount; row++)
+    {
+        for (i32 column = 0; column < table->columnCount; column++)
+        {
+            nodePtr->x = (r32)(column * RAY_LOOKUP_STEP);
+            nodePtr->y = (r32)(row * RAY_LOOKUP_STEP);
+            nodePtr++;
+        }
+    }
+    
+    CV_undistortPoints(nodePoints, undistPoints, nodeCount, calibration);
+    
+    for (i32 i = 0; i < nodeCount; i++)
+    {
+        V4 direction = multM4x4V4(cTw->inv,
+                                  v4(undistPoints[i].x, undistPoints[i].y,
+                                     1.0f, 0.0f));
+        table->directions[i] = v3(direction.x, direction.y, direction.z);
+    }
+    
+    V4 wC = multM4x4V4(cTw->inv, v4(0.0f, 0.0f, 0.0f, 1.0f));
+    table->origin = v3(wC.x, wC.y, wC.z);
+    
+    table->calibration = *calibration;
+    table->wTc = cTw->inv;
+    table->isValid = 1;
+    
+    endTemporaryMemory(tempMem);
+}
+
+// NOTE(jan): takes a distorted pixel position, replaces undistorting the
+// point and casting it with castCameraToWorld
+static Ray castPixelToWorld(RayLookupTable* table, V2 pixel)
+{
+    Ray result = {};
+    
+    r32 x = pixel.x / RAY_LOOKUP_STEP;
+    r32 y = pixel.y / RAY_LOOKUP_STEP;
+    
+    i32 column = (i32)x;
+    i32 row = (i32)y;
+    if (column < 0)
+    {
+        column = 0;
+    }
+    else if (column > table->columnCount - 2)
+    {
+        column = table->columnCount - 2;
+    }
+    if (row < 0)
+    {
+        row = 0;
+    }
+    else if (row > table->rowCount - 2)
+    {
+        row = table->rowCount - 2;
+    }
+    
+    r32 u = x - column;
+    r32 v = y - row;
+    
+    V3* top = table->directions + row * table->columnCount + column;
+    V3* bottom = top + table->columnCount;
+    
+    V3 direction = multV3R(top[0], (1.0f - u) * (1.0f - v));
+    direction = addV3(direction, multV3R(top[1], u * (1.0f - v)));
+    direction = addV3(direction, multV3R(bottom[0], (1.0f - u) * v));
+    direction = addV3(direction, multV3R(bottom[1], u * v));
+    
+    result.origin = table->origin;
+    result.direction = normalizeV3(direction);
+    
+    return result;
+}
+
 static V2 projectWorldToCamera(V3* worldPoint,
                                M4x4* cTw,
                                Calibration* calibration)
@@ -119,39 +232,163 @@ static void calculateChessboardWorldPoints(r32 chessboardFieldEdgeInCm,
     }
 }
 
+static void downSample(Frame* inputFrame,
+                       Frame* outputFrame)
+{
+    assert(inputFrame->bytesPerPixel == 1);
+    assert(outputFrame->bytesPerPixel == 1);
+    
+    i32 samplingRateX = inputFrame->width / outputFrame->width;
+    i32 samplingRateY = inputFrame->height / outputFrame->height;
+    
+    u8* inputRow = (u8*)inputFrame->memory;
+    u8* outputRow = (u8*)outputFrame->memory;
+    
+    r32 oneOverSamplingRate = 1.0f / (samplingRateX * samplingRateY);
+    
+    for (i32 y = 0; 
+         y < outputFrame->height; 
+         y++)
+    {
+        u8* inputPixel = inputRow;
+        u8* outputPixel = outputRow;
+        
+        for (i32 x = 0; 
+             x < outputFrame->width; 
+             x++)
+        {
+            u32 inputVal = 0;
+            for (i32 sampleY = 0;
+                 sampleY < samplingRateY;
+                 sampleY++)
+            {
+                for (i32 sampleX = 0;
+                     sampleX < samplingRateX;
+                     sampleX++)
+                {
+                    inputVal += *(inputPixel + 
+                                  sampleY * inputFrame->pitch +
+                                  sampleX * inputFrame->bytesPerPixel);
+                }
+            }
+            
+            u8 val = (r32)inputVal * oneOverSamplingRate;
+            
+            *outputPixel = val;
+            
+            inputPixel += (samplingRateX * inputFrame->bytesPerPixel);
+            outputPixel += outputFrame->bytesPerPixel;
+        }
+        
+        inputRow += (samplingRateY * inputFrame->pitch);
+        outputRow += outputFrame->pitch;
+    }
+}
+
+// NOTE(jan): the board is searched for coarse to fine, starting in the
+// smallest frame of the pyramid, where the search is a lot faster, and
+// only falling back to finer levels if it isn't found there. The corners
+// are refined in windows around them in the full frame. A
+// downsampleFactor of 0 picks the coarsest level for the frame size.
 static bool32 CV_findChessboardCorners(Frame* grayscaleFrame,
                                        i32 innerRowCount, i32 innerColumnCount,
-                                       void* corners)
+                                       void* corners,
+                                       i32 downsampleFactor = 0)
 {
     bool32 result = 0;
     
     i32 cornerCount = innerRowCount * innerColumnCount;
     cv::Size chessboardSize = cv::Size(innerColumnCount, innerRowCount);
     
+    if (downsampleFactor <= 0)
+    {
+        downsampleFactor = 1;
+        while (downsampleFactor < CHESSBOARD_PYRAMID_MAX_FACTOR &&
+               grayscaleFrame->width / (downsampleFactor * 2) >= CHESSBOARD_PYRAMID_MIN_WIDTH)
+        {
+            downsampleFactor *= 2;
+        }
+    }
+    
     cv::Mat img = cv::Mat(grayscaleFrame->height,
                           grayscaleFrame->width,
                           CV_8UC1,
                           grayscaleFrame->memory,
                           grayscaleFrame->pitch);
+    
+    // NOTE(jan): every level is a box filtered copy of the one below
+    cv::Mat levels[CHESSBOARD_PYRAMID_MAX_LEVEL_COUNT];
+    i32 levelCount = 1;
+    levels[0] = img;
+    for (i32 factor = 2;
+         factor <= downsampleFactor && levelCount < CHESSBOARD_PYRAMID_MAX_LEVEL_COUNT;
+         factor *= 2)
+    {
+        cv::Mat* finer = &levels[levelCount - 1];
+        cv::Mat* coarser = &levels[levelCount];
+        *coarser = cv::Mat(finer->rows / 2, finer->cols / 2, CV_8UC1);
+        
+        Frame finerFrame = {};
+        finerFrame.memory = finer->data;
+        finerFrame.width = finer->cols;
+        finerFrame.height = finer->rows;
+        finerFrame.bytesPerPixel = 1;
+        finerFrame.pitch = (i32)finer->step[0];
+        Frame coarserFrame = finerFrame;
+        coarserFrame.memory = coarser->data;
+        coarserFrame.width = coarser->cols;
+        coarserFrame.height = coarser->rows;
+        coarserFrame.pitch = (i32)coarser->step[0];
+        downSample(&finerFrame, &coarserFrame);
+        
+        levelCount++;
+    }
+    
     cv::Mat cameraPoints = cv::Mat(cornerCount, 1, CV_32FC2, corners);
-    bool32 cornersFound = cv::findChessboardCorners(img,
-                                                    chessboardSize,
-                                                    cameraPoints,
-                                                    cv::CALIB_CB_ADAPTIVE_THRESH |
-                                                    cv::CALIB_CB_NORMALIZE_IMAGE |
-                                                    cv::CALIB_CB_FAST_CHECK);
+    i32 levelFactor = 1 << (levelCount - 1);
+    for (i32 level = levelCount - 1; level >= 0; level--)
+    {
+        bool32 cornersFound = cv::findChessboardCorners(levels[level],
+                                                        chessboardSize,
+                                                        cameraPoints,
+                                                        cv::CALIB_CB_ADAPTIVE_THRESH |
+                                                        cv::CALIB_CB_NORMALIZE_IMAGE |
+                                                        cv::CALIB_CB_FAST_CHECK);
+        if (cornersFound)
+        {
+            result = 1;
+            break;
+        }
+        levelFactor /= 2;
+    }
     
-    if (cornersFound)
+    if (result)
     {
+        if (levelFactor > 1)
+        {
+            // NOTE(jan): pixel centers of the small image sit between
+            // those of the full one
+            r32 scale = (r32)levelFactor;
+            cv::Point2f* points = (cv::Point2f*)corners;
+            for (i32 i = 0; i < cornerCount; i++)
+            {
+                points[i].x = (points[i].x + 0.5f) * scale - 0.5f;
+                points[i].y = (points[i].y + 0.5f) * scale - 0.5f;
+            }
+        }
+        
+        // NOTE(jan): corners from a coarser level are off by up to about
+        // a coarse pixel, the window only has to cover that
+        i32 halfWindow = min(CHESSBOARD_REFINE_HALF_WINDOW * levelFactor,
+                             CHESSBOARD_REFINE_MAX_HALF_WINDOW);
         cv::cornerSubPix(img, 
                          cameraPoints,
-                         cv::Size(11, 11),
+                         cv::Size(halfWindow, halfWindow),
                          cv::Size(-1, -1),
                          cv::TermCriteria(cv::TermCriteria::EPS + 
                                           cv::TermCriteria::COUNT, 
-                                          30000, 
-                                          0.01));
-        result = 1;
+                                          CHESSBOARD_REFINE_MAX_ITERATIONS, 
+                                          CHESSBOARD_REFINE_EPSILON));
     }
     
     return result;
@@ -160,7 +397,8 @@ static bool32 CV_findChessboardCorners(Frame* grayscaleFrame,
 static bool32 CV_estimatePose(MemoryArena* arena,
                               Calibration* calibration,
                               Frame* grayscaleFrame,
-                              M4x4inv* cTw)
+                              M4x4inv* cTw,
+                              i32 downsampleFactor = 0)
 {
     bool32 result = 0;
     
@@ -173,7 +411,8 @@ static bool32 CV_estimatePose(MemoryArena* arena,
     bool32 cornersFound = 
         CV_findChessboardCorners(grayscaleFrame,
                                  innerRowCount, innerColumnCount,
-                                 &cameraPoints.at<cv::Point2f>(0, 0));
+                                 &cameraPoints.at<cv::Point2f>(0, 0),
+                                 downsampleFactor);
     
     if (cornersFound)
     {
@@ -283,119 +522,6 @@ static void CV_convertCaptureFrameToGrayscale(Frame* captureFrame,
     cv::mixChannels(&captureFrameMat, 1, &outputFrameMat, 1, from_to, 1);
 }
 
-static void floodFill(MemoryArena* arena,
-                      Frame* binarizedFrame,
-                      i32 u, i32 v,
-                      u8 filledValue, 
-                      u8 label,
-                      Region* r)
-{
-    TemporaryMemory tempMem = beginTemporaryMemory(arena);
-    V2* q = pushStruct(arena, V2);
-    V2* first = q;
-    first->x = u;
-    first->y = v;
-    
-    i32 maxX = u;
-    i32 maxY = v;
-    i32 minX = u;
-    i32 minY = v;
-    
-    u32 stackSize = 1;
-    u32 regionSize = 1;
-    while (stackSize)
-    {
-        stackSize--;
-        V2* p = q++;
-        
-        i32 x = p->x;
-        i32 y = p->y;
-        if (x >= 0 && x < binarizedFrame->width &&
-            y >= 0 && y < binarizedFrame->height)
-        {
-            u8* val = (u8*)binarizedFrame->memory + y*binarizedFrame->pitch + x*binarizedFrame->bytesPerPixel;
-            if (*val == filledValue)
-            {
-                maxX = max(x, maxX);
-                maxY = max(y, maxY);
-                minX = min(x, minX);
-                minY = min(y, minY);
-                
-                *val = label;
-                V2* pN = pushStruct(arena, V2);
-                pN->x = x+1;
-                pN->y = y;
-                stackSize++;
-                pN = pushStruct(arena, V2);
-                pN->x = x-1;
-                pN->y = y;
-                stackSize++;
-                pN = pushStruct(arena, V2);
-                pN->x = x;
-                pN->y = y+1;
-                stackSize++;
-                pN = pushStruct(arena, V2);
-                pN->x = x;
-                pN->y = y-1;
-                stackSize++;
-                
-                regionSize++;
-            }
-        }
-    }
-    
-    r->size = regionSize;
-    r->label = label;
-    r->max = {maxX / (r32)binarizedFrame->width, maxY / (r32)binarizedFrame->height};
-    r->min = {minX / (r32)binarizedFrame->width, minY / (r32)binarizedFrame->height};
-    
-    r->width =
-        (maxX - minX) / (r32)binarizedFrame->width;
-    r->height =
-        (maxY - minY) / (r32)binarizedFrame->height;
-    
-    r->center.x = (maxX + minX) / 2.0f;
-    r->center.y = (maxY + minY) / 2.0f;
-    
-    endTemporaryMemory(tempMem);
-}
-
-static RegionLabelingResult regionLabeling(MemoryArena* arena,
-                                           Frame* binarizedFrame)
-{
-    RegionLabelingResult result = {};
-    
-    u8 label = 250;
-    
-    u8* row = (u8*)binarizedFrame->memory;
-    i32 regionIndex = 0;
-    for (i32 y = 0; y < binarizedFrame->height; y++)
-    {
-        u8* pixel = row;
-        for (i32 x = 0; x < binarizedFrame->width; x++)
-        {
-            if (*pixel == 255)
-            {
-                Region* region = pushStruct(arena, Region);
-                
-                if (!result.region)
-                {
-                    result.region = region;
-                }
-                
-                floodFill(arena, binarizedFrame, x, y, 255, label, region);
-                result.regionCount = result.regionCount + 1;
-            }
-            
-            pixel += binarizedFrame->bytesPerPixel;
-        }
-        
-        row += binarizedFrame->pitch;
-    }
-    
-    return result;
-}
-
 static BlobVector CV_detectBlobs(MemoryArena* arena,
                                  Frame* inputFrame,
                                  i32 threshold)
@@ -438,7 +564,8 @@ static BlobVector CV_detectBlobs(MemoryArena* arena,
     {
         pushBlob(arena,
                  &result,
-                 v2(keypoint.pt.x, keypoint.pt.y));
+                 v2(keypoint.pt.x + inputFrame->originX,
+                    keypoint.pt.y + inputFrame->originY));
     }
     
     return result;
@@ -482,59 +609,6 @@ static void CV_convertYUYVtoYAndBinarize(MemoryArena* arena,
                 threshold);
 }
 
-static void downSample(Frame* inputFrame,
-                       Frame* outputFrame)
-{
-    assert(inputFrame->bytesPerPixel == 1);
-    assert(outputFrame->bytesPerPixel == 1);
-    
-    i32 samplingRateX = inputFrame->width / outputFrame->width;
-    i32 samplingRateY = inputFrame->height / outputFrame->height;
-    
-    u8* inputRow = (u8*)inputFrame->memory;
-    u8* outputRow = (u8*)outputFrame->memory;
-    
-    r32 oneOverSamplingRate = 1.0f / (samplingRateX * samplingRateY);
-    
-    for (i32 y = 0; 
-         y < outputFrame->height; 
-         y++)
-    {
-        u8* inputPixel = inputRow;
-        u8* outputPixel = outputRow;
-        
-        for (i32 x = 0; 
-             x < outputFrame->width; 
-             x++)
-        {
-            u32 inputVal = 0;
-            for (i32 sampleY = 0;
-                 sampleY < samplingRateY;
-                 sampleY++)
-            {
-                for (i32 sampleX = 0;
-                     sampleX < samplingRateX;
-                     sampleX++)
-                {
-                    inputVal += *(inputPixel + 
-                                  sampleY * inputFrame->pitch +
-                                  sampleX * inputFrame->bytesPerPixel);
-                }
-            }
-            
-            u8 val = (r32)inputVal * oneOverSamplingRate;
-            
-            *outputPixel = val;
-            
-            inputPixel += (samplingRateX * inputFrame->bytesPerPixel);
-            outputPixel += outputFrame->bytesPerPixel;
-        }
-        
-        inputRow += (samplingRateY * inputFrame->pitch);
-        outputRow += outputFrame->pitch;
-    }
-}
-
 static void convertYUYVtoYAndBinarize(Frame* inputFrame,
                                       Frame* grayscaleFrame,
                                       Frame* binarizedFrame,
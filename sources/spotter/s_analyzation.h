@@ -3,22 +3,18 @@
 
 #include <opencv2/opencv.hpp>
 
-struct Region
-{
-    V2 origin;
-    V2 max;
-    V2 min;
-    V2 center;
-    r32 width, height;
-    u8 label;
-    i32 size;
-};
+// NOTE(jan): the chessboard search starts in a frame downsampled by up
+// to this factor, as long as it stays at least this wide
+#define CHESSBOARD_PYRAMID_MAX_FACTOR 4
+#define CHESSBOARD_PYRAMID_MAX_LEVEL_COUNT 3
+#define CHESSBOARD_PYRAMID_MIN_WIDTH 320
 
-struct RegionLabelingResult
-{
-    Region* region;
-    i32 regionCount;
-};
+// NOTE(jan): half the edge of the corner refinement window per level of
+// downsampling the corners were found at
+#define CHESSBOARD_REFINE_HALF_WINDOW 3
+#define CHESSBOARD_REFINE_MAX_HALF_WINDOW 8
+#define CHESSBOARD_REFINE_MAX_ITERATIONS 30
+#define CHESSBOARD_REFINE_EPSILON 0.01
 
 struct Calibration
 {
@@ -33,9 +29,46 @@ struct Calibration
     };
 };
 
+// NOTE(jan): grid nodes are RAY_LOOKUP_STEP pixels apart, the
+// undistortion is smooth enough for bilinear interpolation in between
+#define RAY_LOOKUP_STEP 8
+
+// NOTE(jan): undistorted viewing directions in world space, one per grid
+// node. They are kept at camera space z = 1 instead of unit length, which
+// keeps them linear in the undistorted image plane, so interpolating them
+// is exact up to the undistortion itself.
+struct RayLookupTable
+{
+    V3* directions;
+    i32 columnCount;
+    i32 rowCount;
+    i32 width;
+    i32 height;
+    
+    V3 origin;
+    bool32 isValid;
+    
+    // NOTE(jan): what the table was built from, it is only rebuilt when
+    // one of them changes
+    Calibration calibration;
+    M4x4 wTc;
+};
+
+// NOTE(jan): what the extraction found out about a blob besides its
+// position, tells markers from reflections and noise
+struct BlobQuality
+{
+    i32 area;
+    u8 peak;
+    r32 circularity; // minor over major axis, 1 for a disc
+    r32 centroidUncertainty; // rms, in pixels
+};
+
+// NOTE(jan): qualities is parallel to blobs, if the detection has them
 struct BlobVector
 {
     V2* blobs;
+    BlobQuality* qualities;
     i32 count;
     i32 maxCount;
 };
@@ -26,68 +26,106 @@ static i32 xioctl(i32 fd, i32 request, void *arg)
     return result;
 }
 
-static bool32 readFrame(CaptureState* state,
-                        Frame** outputFrame)
+// NOTE(jan): implemented in s_replay.cpp
+static bool32 readReplayFrame(ReplayState* replay,
+                              Frame** outputFrame);
+static void stopReplay(ReplayState* replay);
+
+static CaptureConfig getDefaultCaptureConfig()
+{
+    CaptureConfig result = {};
+    
+    result.width = CAPTURE_FRAME_WIDTH;
+    result.height = CAPTURE_FRAME_HEIGHT;
+    result.pixelFormat = V4L2_PIX_FMT_GREY;
+    result.bytesPerPixel = 1;
+    result.fps = CAPTURE_DEFAULT_FPS;
+    
+    return result;
+}
+
+static bool32 parseCapturePixelFormat(const char* name,
+                                      CaptureConfig* config)
+{
+    bool32 result = 1;
+    
+    if (strcmp(name, "grey") == 0)
+    {
+        config->pixelFormat = V4L2_PIX_FMT_GREY;
+        config->bytesPerPixel = 1;
+    }
+    else if (strcmp(name, "yuyv") == 0)
+    {
+        config->pixelFormat = V4L2_PIX_FMT_YUYV;
+        config->bytesPerPixel = 2;
+    }
+    else
+    {
+        printf("Unknown pixel format %s, use grey or yuyv\n", name);
+        result = 0;
+    }
+    
+    return result;
+}
+
+// NOTE(jan): largest frame size the device offers for the pixel format
+static bool32 findMaxCaptureFrameSize(i32 fd,
+                                      u32 pixelFormat,
+                                      i32* width,
+                                      i32* height)
 {
     bool32 result = 0;
     
-    v4l2_buffer buf = {};
-    buf.type = state->type;
-    buf.memory = state->memoryType;
+    v4l2_frmsizeenum frameSize = {};
+    frameSize.pixel_format = pixelFormat;
     
-#if 1
-    while (!xioctl(state->fd, VIDIOC_DQBUF, &buf))
+    while (xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frameSize))
     {
-        if (errno == EAGAIN)
+        i32 frameWidth = 0;
+        i32 frameHeight = 0;
+        if (frameSize.type == V4L2_FRMSIZE_TYPE_DISCRETE)
         {
-            usleep(10);
-            continue;
+            frameWidth = frameSize.discrete.width;
+            frameHeight = frameSize.discrete.height;
         }
         else
         {
-            printErrno();
-            return result;
+            frameWidth = frameSize.stepwise.max_width;
+            frameHeight = frameSize.stepwise.max_height;
         }
-    }
-    
-    assert(buf.index < state->bufferCount);
-    result = 1;
-    *outputFrame = &state->buffers[buf.index];
-    state->readBufferIndex = buf.index;
-#else
-    while (xioctl(state->fd, VIDIOC_DQBUF, &buf))
-    {
-        if (errno == EAGAIN)
+        
+        if (frameWidth * frameHeight > *width * *height || !result)
         {
-            usleep(10);
-            continue;
+            *width = frameWidth;
+            *height = frameHeight;
+            result = 1;
         }
-        else
+        
+        if (frameSize.type != V4L2_FRMSIZE_TYPE_DISCRETE)
         {
-            printErrno();
-            return result;
+            break;
         }
+        frameSize.index++;
     }
     
-    assert(buf.index < state->bufferCount);
-    outputFrame = &state->buffers[buf.index];
-    state->readBufferIndex = buf.index;
-#endif
-    
     return result;
 }
 
-static bool32 requeueBuffer(CaptureState* state)
+static bool32 queueBuffer(CaptureState* state,
+                          i32 bufferIndex)
 {
     bool32 result = 1;
     
-    Frame* buffer = &state->buffers[state->readBufferIndex];
+    Frame* buffer = &state->buffers[bufferIndex];
     
     v4l2_buffer buf = {};
     buf.type = state->type;
     buf.memory = state->memoryType;
+    buf.index = bufferIndex;
+#if CAPTURE_MEM_TYPE_USERPTR
     buf.m.userptr = (u64)buffer->memory;
     buf.length = buffer->size;
+#endif
     
     if (!xioctl(state->fd, VIDIOC_QBUF, &buf))
     {
@@ -98,8 +136,405 @@ static bool32 requeueBuffer(CaptureState* state)
     return result;
 }
 
+static void captureWorker(CaptureState* state)
+{
+    pollfd pollItem = {};
+    pollItem.fd = state->fd;
+    pollItem.events = POLLIN;
+    
+    while (1)
+    {
+        state->mutex.lock();
+        bool32 running = state->running;
+        state->mutex.unlock();
+        if (!running)
+        {
+            break;
+        }
+        
+        i32 pollResult = poll(&pollItem, 1, CAPTURE_POLL_TIMEOUT_MS);
+        if (pollResult <= 0)
+        {
+            if (pollResult == -1 && errno != EINTR)
+            {
+                printErrno();
+            }
+            continue;
+        }
+        
+        // NOTE(jan): the fd is non blocking, take everything the driver
+        // has finished since the last wakeup
+        v4l2_buffer buf = {};
+        buf.type = state->type;
+        buf.memory = state->memoryType;
+        while (xioctl(state->fd, VIDIOC_DQBUF, &buf))
+        {
+            assert(buf.index < state->bufferCount);
+            
+            i32 staleBufferIndex = -1;
+            
+            // NOTE(jan): the buffer belongs to this thread until it is
+            // published as the latest one
+            Frame* frame = &state->buffers[buf.index];
+            frame->timestampUs =
+                (u64)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+            frame->sequence = buf.sequence;
+            
+            state->mutex.lock();
+            staleBufferIndex = state->latestBufferIndex;
+            state->latestBufferIndex = buf.index;
+            state->capturedCount++;
+            if (staleBufferIndex != -1)
+            {
+                state->skippedCount++;
+            }
+            state->mutex.unlock();
+            state->frameReady.notify_one();
+            
+            if (staleBufferIndex != -1)
+            {
+                queueBuffer(state, staleBufferIndex);
+            }
+            
+            buf = {};
+            buf.type = state->type;
+            buf.memory = state->memoryType;
+        }
+        
+        if (errno != EAGAIN)
+        {
+            printErrno();
+        }
+    }
+}
+
+static bool32 requeueBuffer(CaptureState* state)
+{
+    bool32 result = 1;
+    
+    if (state->readBufferIndex != -1)
+    {
+        result = queueBuffer(state, state->readBufferIndex);
+        state->readBufferIndex = -1;
+    }
+    
+    return result;
+}
+
+// NOTE(jan): waits for a frame newer than the last one read. The frame
+// stays valid until requeueBuffer is called and carries the kernel
+// timestamp and sequence number of its buffer.
+static bool32 readFrame(CaptureState* state,
+                        Frame** outputFrame)
+{
+    bool32 result = 0;
+    
+    if (state->backend == CaptureBackend_Replay)
+    {
+        return readReplayFrame(state->replay, outputFrame);
+    }
+    
+    if (state->readBufferIndex != -1)
+    {
+        requeueBuffer(state);
+    }
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->frameReady.wait_for(lock,
+                               std::chrono::milliseconds(CAPTURE_READ_TIMEOUT_MS),
+                               [state] {
+                                   return (state->latestBufferIndex != -1 ||
+                                           !state->running);
+                               });
+    
+    if (state->latestBufferIndex != -1)
+    {
+        result = 1;
+        state->readBufferIndex = state->latestBufferIndex;
+        state->latestBufferIndex = -1;
+        *outputFrame = &state->buffers[state->readBufferIndex];
+    }
+    else
+    {
+        printf("No frame captured within %i ms\n", CAPTURE_READ_TIMEOUT_MS);
+    }
+    
+    return result;
+}
+
+static void stopCaptureWorker(CaptureState* state)
+{
+    if (state->running)
+    {
+        state->mutex.lock();
+        state->running = 0;
+        state->mutex.unlock();
+        state->frameReady.notify_all();
+        state->thread.join();
+    }
+}
+
+// NOTE(jan): a view into the frame, no pixels are copied. The rectangle
+// is given in full sensor pixels and clamped to the frame.
+static Frame cropFrame(Frame* frame,
+                       i32 x,
+                       i32 y,
+                       i32 width,
+                       i32 height)
+{
+    i32 left = max(x - frame->originX, 0);
+    i32 top = max(y - frame->originY, 0);
+    i32 right = min(x - frame->originX + width, frame->width);
+    i32 bottom = min(y - frame->originY + height, frame->height);
+    
+    Frame result = *frame;
+    
+    if (left < right && top < bottom)
+    {
+        result.memory = ((u8*)frame->memory +
+                         top * frame->pitch +
+                         left * frame->bytesPerPixel);
+        result.width = right - left;
+        result.height = bottom - top;
+        result.size = result.pitch * result.height;
+        result.originX = frame->originX + left;
+        result.originY = frame->originY + top;
+    }
+    
+    return result;
+}
+
+// NOTE(jan): stops the stream and takes the buffers back from the
+// driver, the format can only change after this. The memory stays, it's
+// big enough for full frames.
+static void releaseCaptureStream(CaptureState* state)
+{
+    if (!xioctl(state->fd, VIDIOC_STREAMOFF, &state->type))
+    {
+        printErrno();
+    }
+    state->latestBufferIndex = -1;
+    
+    v4l2_requestbuffers req = {};
+    req.type = state->type;
+    req.memory = state->memoryType;
+    req.count = 0;
+    xioctl(state->fd, VIDIOC_REQBUFS, &req);
+}
+
+// NOTE(jan): hands the buffers to the driver for frames of the given
+// format, which start at x, y on the sensor, and starts the stream and
+// the capture thread again
+static bool32 restartCaptureStream(CaptureState* state,
+                                   v4l2_format* fmt,
+                                   i32 x,
+                                   i32 y)
+{
+    v4l2_requestbuffers req = {};
+    req.type = state->type;
+    req.memory = state->memoryType;
+    req.count = state->bufferCount;
+    if (!xioctl(state->fd, VIDIOC_REQBUFS, &req))
+    {
+        printErrno();
+        return 0;
+    }
+    
+    for (u32 i = 0; i < state->bufferCount; i++)
+    {
+        Frame* buffer = &state->buffers[i];
+        buffer->width = fmt->fmt.pix.width;
+        buffer->height = fmt->fmt.pix.height;
+        buffer->pitch = fmt->fmt.pix.bytesperline;
+        buffer->size = fmt->fmt.pix.sizeimage;
+        buffer->originX = x;
+        buffer->originY = y;
+        
+        if (!queueBuffer(state, i))
+        {
+            return 0;
+        }
+    }
+    
+    if (!xioctl(state->fd, VIDIOC_STREAMON, &state->type))
+    {
+        printErrno();
+        return 0;
+    }
+    
+    state->running = 1;
+    state->thread = std::thread(captureWorker, state);
+    
+    return 1;
+}
+
+// NOTE(jan): lets the driver only deliver the given rectangle of the
+// sensor image, through the selection api. The format can only change
+// while the stream is off, so the capture is restarted and a few frames
+// are lost; call this only when the rectangle really changed and not
+// while a frame is read. If the driver does not crop exactly as asked,
+// or the cropped stream doesn't start, it is set back to full frames and
+// the caller has to crop in software. If not even that works, there is
+// no capture anymore.
+static CaptureCropResult setCaptureCrop(CaptureState* state,
+                                        i32 x,
+                                        i32 y,
+                                        i32 width,
+                                        i32 height)
+{
+    assert(state->readBufferIndex == -1);
+    
+    if (state->backend == CaptureBackend_Replay)
+    {
+        return CaptureCropResult_Software;
+    }
+    
+#if CAPTURE_MEM_TYPE_USERPTR
+    if (x == state->cropX && y == state->cropY &&
+        width == state->cropWidth && height == state->cropHeight)
+    {
+        return CaptureCropResult_Hardware;
+    }
+    
+    // NOTE(jan): crop rectangles are in sensor pixels, as long as the
+    // driver scales they are not in frame pixels
+    v4l2_selection defaultSelection = {};
+    defaultSelection.type = state->type;
+    defaultSelection.target = V4L2_SEL_TGT_CROP_DEFAULT;
+    if (!xioctl(state->fd, VIDIOC_G_SELECTION, &defaultSelection))
+    {
+        printf("Device does not support the selection api, cropping in software\n");
+        return CaptureCropResult_Software;
+    }
+    
+    if ((i32)defaultSelection.r.width != state->config.width ||
+        (i32)defaultSelection.r.height != state->config.height)
+    {
+        printf("Device scales the sensor image, cropping in software\n");
+        return CaptureCropResult_Software;
+    }
+    
+    stopCaptureWorker(state);
+    releaseCaptureStream(state);
+    
+    v4l2_selection selection = {};
+    selection.type = state->type;
+    selection.target = V4L2_SEL_TGT_CROP;
+    selection.r.left = x + defaultSelection.r.left;
+    selection.r.top = y + defaultSelection.r.top;
+    selection.r.width = width;
+    selection.r.height = height;
+    
+    v4l2_format fmt = {};
+    fmt.type = state->type;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = state->config.pixelFormat;
+    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    
+    if (xioctl(state->fd, VIDIOC_S_SELECTION, &selection) &&
+        xioctl(state->fd, VIDIOC_S_FMT, &fmt) &&
+        selection.r.left == x + defaultSelection.r.left &&
+        selection.r.top == y + defaultSelection.r.top &&
+        (i32)selection.r.width == width &&
+        (i32)selection.r.height == height &&
+        (i32)fmt.fmt.pix.width == width &&
+        (i32)fmt.fmt.pix.height == height)
+    {
+        if (restartCaptureStream(state, &fmt, x, y))
+        {
+            state->cropX = x;
+            state->cropY = y;
+            state->cropWidth = width;
+            state->cropHeight = height;
+            
+            printf("Capturing %i x %i at %i, %i\n", width, height, x, y);
+            return CaptureCropResult_Hardware;
+        }
+        
+        printf("Could not restart the capture cropped to %i x %i at %i, %i, "
+               "cropping in software\n",
+               width, height, x, y);
+        releaseCaptureStream(state);
+    }
+    else
+    {
+        printf("Device can't crop to %i x %i at %i, %i, cropping in software\n",
+               width, height, x, y);
+    }
+    
+    // NOTE(jan): back to full frames, the stream is off and the driver
+    // has no buffers at this point
+    selection.target = V4L2_SEL_TGT_CROP;
+    selection.r = defaultSelection.r;
+    xioctl(state->fd, VIDIOC_S_SELECTION, &selection);
+    
+    fmt = {};
+    fmt.type = state->type;
+    fmt.fmt.pix.width = state->config.width;
+    fmt.fmt.pix.height = state->config.height;
+    fmt.fmt.pix.pixelformat = state->config.pixelFormat;
+    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    if (!xioctl(state->fd, VIDIOC_S_FMT, &fmt))
+    {
+        printErrno();
+        printf("Could not set the capture back to full frames\n");
+        return CaptureCropResult_Failed;
+    }
+    
+    state->cropX = 0;
+    state->cropY = 0;
+    state->cropWidth = state->config.width;
+    state->cropHeight = state->config.height;
+    
+    if (!restartCaptureStream(state, &fmt, 0, 0))
+    {
+        printf("Could not restart the capture with full frames\n");
+        return CaptureCropResult_Failed;
+    }
+    
+    return CaptureCropResult_Software;
+#else
+    // NOTE(jan): mmapped buffers would have to be remapped for the new
+    // size, only user pointer i/o crops in hardware
+    return CaptureCropResult_Software;
+#endif
+}
+
+// NOTE(jan): keeps the frame handed out by readFrame out of the driver's
+// hands, requeueBuffer leaves it alone. It has to be given back with
+// releaseFrame, which may be called from any thread.
+static i32 pinFrame(CaptureState* state)
+{
+    i32 result = state->readBufferIndex;
+    state->readBufferIndex = -1;
+    
+    return result;
+}
+
+static bool32 releaseFrame(CaptureState* state,
+                           i32 bufferIndex)
+{
+    return queueBuffer(state, bufferIndex);
+}
+
 static i32 stopCapturing(CaptureState* state)
 {
+    if (state->backend == CaptureBackend_Replay)
+    {
+        stopReplay(state->replay);
+        return 1;
+    }
+    
+    if (state->running)
+    {
+        stopCaptureWorker(state);
+        
+        printf("Captured %" PRIu64 " frames, %" PRIu64 " replaced before being read\n",
+               state->capturedCount,
+               state->skippedCount);
+    }
+    
     // NOTE(jan): turn capture stream off
     if (!xioctl(state->fd, VIDIOC_STREAMOFF, &state->type))
     {
@@ -123,12 +558,15 @@ static i32 stopCapturing(CaptureState* state)
 static bool32 startCapturing(MemoryArena* arena,
                              CaptureState* state,
                              u32 bufferCount,
-                             const char* devName)
+                             const char* devName,
+                             CaptureConfig config)
 {
     assert(bufferCount <= CAPTURE_BUFFER_COUNT);
     
     state->bufferCount = bufferCount;
     state->fd = -1;
+    state->readBufferIndex = -1;
+    state->latestBufferIndex = -1;
     state->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 #if CAPTURE_MEM_TYPE_USERPTR
     state->memoryType = V4L2_MEMORY_USERPTR;
@@ -187,22 +625,56 @@ static bool32 startCapturing(MemoryArena* arena,
         return 0;
     }
     
-    // NOTE(jan): set required capture format
+    if (config.binning > 0)
+    {
+        i32 sensorWidth = 0;
+        i32 sensorHeight = 0;
+        if (findMaxCaptureFrameSize(state->fd,
+                                    config.pixelFormat,
+                                    &sensorWidth,
+                                    &sensorHeight))
+        {
+            config.width = sensorWidth / config.binning;
+            config.height = sensorHeight / config.binning;
+        }
+        else
+        {
+            printf("Could not enumerate frame sizes, binning ignored\n");
+        }
+    }
+    
+    // NOTE(jan): set required capture format, the driver answers with the
+    // closest format it supports
     v4l2_format fmt = {};
     fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     
-    fmt.fmt.pix.width = CAPTURE_FRAME_WIDTH;
-    fmt.fmt.pix.height = CAPTURE_FRAME_HEIGHT;
-    //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_GREY;
+    fmt.fmt.pix.width = config.width;
+    fmt.fmt.pix.height = config.height;
+    fmt.fmt.pix.pixelformat = config.pixelFormat;
     fmt.fmt.pix.field = V4L2_FIELD_ANY;
     
     if (!xioctl(state->fd, VIDIOC_S_FMT, &fmt))
     {
         printf("VIDIOC_S_FMT errno: %d, %s\n", errno, strerror(errno));
+        return 0;
+    }
+    
+    if (fmt.fmt.pix.pixelformat != config.pixelFormat)
+    {
+        printf("Pixel format not supported by the device\n");
+        return 0;
+    }
+    
+    if ((i32)fmt.fmt.pix.width != config.width ||
+        (i32)fmt.fmt.pix.height != config.height)
+    {
+        printf("Requested %i x %i, device delivers %i x %i\n",
+               config.width, config.height,
+               fmt.fmt.pix.width, fmt.fmt.pix.height);
     }
+    config.width = fmt.fmt.pix.width;
+    config.height = fmt.fmt.pix.height;
     
-    // NOTE(jan): find and set highest possible frametime
     v4l2_streamparm parm = {};
     parm.type = state->type;
     if (!xioctl(state->fd, VIDIOC_G_PARM, &parm))
@@ -213,58 +685,55 @@ static bool32 startCapturing(MemoryArena* arena,
     }
     
     // NOTE(jan): check if adjusting frametime is supported
-    if (!(parm.parm.capture.capability | V4L2_CAP_TIMEPERFRAME))
+    if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
     {
         printf("Setting frametime not supported\n");
-        printErrno();
-        return 0;
     }
-    
-    v4l2_frmivalenum frameIntervals = {};
-    //frameIntervals.pixel_format = V4L2_PIX_FMT_YUYV;
-    frameIntervals.pixel_format = V4L2_PIX_FMT_GREY;
-    frameIntervals.width = CAPTURE_FRAME_WIDTH;
-    frameIntervals.height = CAPTURE_FRAME_HEIGHT;
-    
-    i32 intervalIndex = 0;
-    i32 bestIntervalIndex = 0;
-    u32 maxDenominator = 0;
-    
-    // NOTE(jan): find the highest possible frametime
-    while (xioctl(state->fd, VIDIOC_ENUM_FRAMEINTERVALS, &frameIntervals))
+    else
     {
-        intervalIndex++;
-        frameIntervals.index = intervalIndex;
+        v4l2_frmivalenum frameIntervals = {};
+        frameIntervals.pixel_format = config.pixelFormat;
+        frameIntervals.width = config.width;
+        frameIntervals.height = config.height;
         
-        if (frameIntervals.discrete.denominator > maxDenominator)
+        while (xioctl(state->fd, VIDIOC_ENUM_FRAMEINTERVALS, &frameIntervals))
         {
-            bestIntervalIndex = intervalIndex;
+            if (frameIntervals.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+            {
+                break;
+            }
+            
+            printf("Possible interval: %i / %i\n", 
+                   frameIntervals.discrete.numerator,
+                   frameIntervals.discrete.denominator);
+            frameIntervals.index++;
         }
         
-        printf("Possible interval: %i / %i\n", 
-               frameIntervals.discrete.numerator,
-               frameIntervals.discrete.denominator);
+        // NOTE(jan): the driver rounds to the closest interval it can do
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = config.fps;
+        if (!xioctl(state->fd, VIDIOC_S_PARM, &parm))
+        {
+            printf("Could not set streaming parameters\n");
+            printErrno();
+            return 0;
+        }
     }
     
-    // NOTE(jan): set the frametime to the highest possible found
-    frameIntervals.index = bestIntervalIndex;
-    xioctl(state->fd, VIDIOC_ENUM_FRAMEINTERVALS, &frameIntervals);
-    
-    frameIntervals.discrete.numerator = 1;
-    frameIntervals.discrete.denominator = 40;
-    printf("Best interval: %i / %i\n", 
-           frameIntervals.discrete.numerator,
-           frameIntervals.discrete.denominator);
-    
-    parm.parm.capture.timeperframe = frameIntervals.discrete;
-    if (!xioctl(state->fd, VIDIOC_S_PARM, &parm))
+    v4l2_fract timePerFrame = parm.parm.capture.timeperframe;
+    if (timePerFrame.numerator)
     {
-        printf("Could not set streaming parameters\n");
-        printErrno();
-        return 0;
+        config.fps = timePerFrame.denominator / timePerFrame.numerator;
     }
+    printf("Capturing %i x %i at %i / %i s per frame\n",
+           config.width, config.height,
+           timePerFrame.numerator, timePerFrame.denominator);
     
-    xioctl(state->fd, VIDIOC_S_PARM, &parm);
+    state->config = config;
+    state->cropX = 0;
+    state->cropY = 0;
+    state->cropWidth = config.width;
+    state->cropHeight = config.height;
     
     // NOTE(jan): request buffers
     v4l2_requestbuffers req = {};
@@ -295,10 +764,13 @@ static bool32 startCapturing(MemoryArena* arena,
         buf.memory = state->memoryType;
         
 #if CAPTURE_MEM_TYPE_USERPTR
-        *buffer = initializeFrame(arena,
-                                  CAPTURE_FRAME_WIDTH,
-                                  CAPTURE_FRAME_HEIGHT,
-                                  1,
+        void* frameMemory = pushSizeAligned(arena,
+                                            fmt.fmt.pix.sizeimage,
+                                            CAPTURE_BUFFER_ALIGNMENT);
+        *buffer = initializeFrame(frameMemory,
+                                  config.width,
+                                  config.height,
+                                  config.bytesPerPixel,
                                   fmt.fmt.pix.bytesperline,
                                   fmt.fmt.pix.sizeimage);
         
@@ -319,20 +791,17 @@ static bool32 startCapturing(MemoryArena* arena,
                                  MAP_SHARED,
                                  state->fd, buf.m.offset);
         *buffer = initializeFrame(frameMemory,
-                                  CAPTURE_FRAME_WIDTH,
-                                  CAPTURE_FRAME_HEIGHT,
-                                  1,
+                                  config.width,
+                                  config.height,
+                                  config.bytesPerPixel,
                                   fmt.fmt.pix.bytesperline,
                                   buf.length);
 #endif
         
-        if (i == 0)
+        if (!xioctl(state->fd, VIDIOC_QBUF, &buf))
         {
-            if (!xioctl(state->fd, VIDIOC_QBUF, &buf))
-            {
-                printErrno();
-                return 0;
-            }
+            printErrno();
+            return 0;
         }
     }
     
@@ -343,5 +812,8 @@ static bool32 startCapturing(MemoryArena* arena,
         return 0;
     }
     
+    state->running = 1;
+    state->thread = std::thread(captureWorker, state);
+    
     return 1;
 }
@@ -1,17 +1,99 @@
 #ifndef CAPTURE_H
 
-#define CAPTURE_BUFFER_COUNT 3
+#include <poll.h>
+
+// NOTE(jan): one buffer is being processed, one holds the newest frame,
+// up to two can be pinned by the recorder and the rest stay queued in
+// the driver
+#define CAPTURE_BUFFER_COUNT 6
 #define CAPTURE_MEM_TYPE_USERPTR 1
 
+#define CAPTURE_POLL_TIMEOUT_MS 100
+#define CAPTURE_READ_TIMEOUT_MS 1000
+
+// NOTE(jan): the build flags only set the defaults, everything can be
+// changed on the command line and is negotiated with the driver
+#ifndef CAPTURE_FRAME_WIDTH
+#define CAPTURE_FRAME_WIDTH 640
+#endif
+#ifndef CAPTURE_FRAME_HEIGHT
+#define CAPTURE_FRAME_HEIGHT 480
+#endif
+#define CAPTURE_DEFAULT_FPS 40
+
+// NOTE(jan): page aligned, so the recorder can write buffers with O_DIRECT
+#define CAPTURE_BUFFER_ALIGNMENT 4096
+
+struct CaptureConfig
+{
+    i32 width;
+    i32 height;
+    u32 pixelFormat; // V4L2_PIX_FMT_GREY or V4L2_PIX_FMT_YUYV
+    i32 bytesPerPixel;
+    
+    // NOTE(jan): 0 keeps width and height, otherwise the largest frame
+    // size of the sensor divided by this is requested, which selects the
+    // sensor's binned mode on the raspberry pi camera
+    i32 binning;
+    i32 fps;
+};
+
+// NOTE(jan): where frames come from. Everything that reads frames goes
+// through readFrame and requeueBuffer and works with either.
+enum CaptureBackend
+{
+    CaptureBackend_Camera,
+    CaptureBackend_Replay, // a recording, see s_replay.cpp
+};
+
+// NOTE(jan): what setCaptureCrop ended up with
+enum CaptureCropResult
+{
+    CaptureCropResult_Hardware, // the driver delivers the rectangle
+    CaptureCropResult_Software, // full frames, the caller crops
+    CaptureCropResult_Failed, // the capture could not be restarted
+};
+
+struct ReplayState;
+
+// NOTE(jan): the capture thread dequeues every frame as soon as the driver
+// has it and keeps only the newest one, the buffer it replaces goes
+// straight back to the driver. readFrame hands out that newest frame,
+// so processing never works through a queue of stale frames.
 struct CaptureState
 {
+    CaptureBackend backend;
+    ReplayState* replay;
+    
     i32 fd;
     v4l2_buf_type type;
     u32 memoryType;
     u32 bufferCount;
     Frame buffers[CAPTURE_BUFFER_COUNT];
+    CaptureConfig config; // as negotiated with the driver
+    
+    // NOTE(jan): sensor area the driver currently delivers, set by
+    // setCaptureCrop. Without a hardware crop it is the whole frame.
+    i32 cropX;
+    i32 cropY;
+    i32 cropWidth;
+    i32 cropHeight;
+    
+    // NOTE(jan): owned by the processing thread, -1 if no buffer is out
     i32 readBufferIndex;
-    i32 saveFileDescriptor;
+    
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable frameReady;
+    
+    // NOTE(jan): set before the worker is started and cleared under
+    // mutex, the worker reads it under the mutex as well
+    bool32 running;
+    
+    // NOTE(jan): guarded by mutex, -1 if there is no new frame
+    i32 latestBufferIndex;
+    u64 capturedCount;
+    u64 skippedCount;
 };
 
 #define CAPTURE_H
@@ -0,0 +1,161 @@
+#ifndef EXTRACTION_H
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// NOTE(jan): blobs outside of this area (in pixels) are not treated as
+// markers, same limits the SimpleBlobDetector path used
+#define EXTRACTION_MIN_BLOB_AREA 1
+#define EXTRACTION_MAX_BLOB_AREA 500
+
+// NOTE(jan): rms noise of a pixel in grey levels, only used to estimate
+// how far off a blob's centroid could be
+#define EXTRACTION_PIXEL_NOISE 2.0f
+
+#define EXTRACTION_MAX_ACCUMULATOR_COUNT 16384
+#define EXTRACTION_MAX_BLOB_COUNT 256
+
+// NOTE(jan): the coarse pass only lets tiles with a pixel above the
+// threshold through to the run extraction
+#define EXTRACTION_TILE_SIZE 16
+
+// NOTE(jan): every n-th pixel of every n-th row goes into the histogram
+#define EXTRACTION_HISTOGRAM_STEP 8
+
+#define EXTRACTION_MAX_THREAD_COUNT 8
+#ifndef EXTRACTION_THREAD_COUNT
+#define EXTRACTION_THREAD_COUNT 4
+#endif
+
+// NOTE(jan): horizontal span of above-threshold pixels in one row. Pixels
+// are weighted with their value above the threshold, so the dim rim of a
+// marker pulls the centroid less than its bright core.
+struct PixelRun
+{
+    i32 startX;
+    i32 endX; // exclusive
+    u32 weightSum;
+    u32 weightedXSum;
+    u8 peak;
+    i32 accumulator;
+};
+
+// NOTE(jan): statistics of a connected set of runs, merged with
+// union-find. The root of a set is always its oldest accumulator, which
+// makes the output order the raster order of the blobs' first pixels.
+// The unweighted moments give the blob's shape, they are summed per run
+// in closed form and cost nothing per pixel.
+struct BlobAccumulator
+{
+    i32 parent;
+    u32 area;
+    u64 weightSum;
+    u64 weightedXSum;
+    u64 weightedYSum;
+    u64 xSum;
+    u64 ySum;
+    u64 xxSum;
+    u64 yySum;
+    u64 xySum;
+    i32 minX, minY;
+    i32 maxX, maxY;
+    u8 peak;
+};
+
+struct TileSpan
+{
+    i32 startX;
+    i32 endX; // exclusive
+};
+
+struct MarkerBlob
+{
+    V2 center; // intensity weighted, in pixels
+    V2 min;
+    V2 max;
+    i32 area;
+    u8 peak;
+    r32 circularity; // minor over major axis, 1 for a disc
+    r32 centroidUncertainty; // rms, in pixels
+};
+
+// NOTE(jan): all buffers are allocated once, extracting a frame does not
+// allocate anything
+struct MarkerExtractor
+{
+    i32 width;
+    i32 height;
+    
+    PixelRun* previousRuns;
+    i32 previousRunCount;
+    PixelRun* currentRuns;
+    i32 currentRunCount;
+    PixelRun* firstRuns;
+    i32 firstRunCount;
+    i32 maxRunCount;
+    
+    BlobAccumulator* accumulators;
+    i32 accumulatorCount;
+    i32 maxAccumulatorCount;
+    
+    MarkerBlob* blobs;
+    i32 blobCount;
+    i32 maxBlobCount;
+    
+    bool32 useTiles;
+    i32 tileColumnCount;
+    u8* tileActive;
+    
+    // NOTE(jan): one byte per tile, row by row. If set, only the tiles
+    // marked in it are looked at, everything else counts as dark.
+    u8* roiTileMask;
+    TileSpan* tileSpans;
+    i32 tileSpanCount;
+    u32 tileCount;
+    u32 activeTileCount;
+    
+    // NOTE(jan): runs and blobs lost to full buffers in the last frame
+    u32 overflowCount;
+    
+    // NOTE(jan): intensities of the last frame, sampled while its rows
+    // are thresholded. Whole rows are sampled, regions of interest or not.
+    u32 histogram[256];
+    u32 histogramSampleCount;
+};
+
+struct ExtractionStrip
+{
+    MarkerExtractor* extractor;
+    i32 startY;
+    i32 endY; // exclusive
+};
+
+// NOTE(jan): the frame is split into horizontal strips, which are
+// extracted in parallel and stitched together at their seams
+struct ExtractionPool
+{
+    MarkerExtractor merged;
+    ExtractionStrip strips[EXTRACTION_MAX_THREAD_COUNT];
+    i32 stripCount;
+    i32 stripLayoutHeight; // frame height the strips were split for
+    
+    std::thread workers[EXTRACTION_MAX_THREAD_COUNT];
+    std::mutex mutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable stripsDone;
+    bool32 running;
+    
+    // NOTE(jan): current job, guarded by mutex
+    u32 generation;
+    i32 pendingStripCount;
+    Frame* frame;
+    u8 threshold;
+};
+
+#define EXTRACTION_H
+#endif
@@ -0,0 +1,221 @@
+#include "s_pose.h"
+
+// NOTE(jan): the rotations are averaged as quaternions, averaging the
+// matrices element-wise gives something that is no rotation anymore.
+// q and -q are the same rotation, so all of them are flipped onto the
+// side of the first before they are summed.
+static M4x4inv averagePoseEstimations(M4x4inv* estimations,
+                                      i32 count)
+{
+    M4x4inv result = {};
+    
+    Quaternion first = quaternionFromM4x4(&estimations[0].fwd);
+    Quaternion sum = {};
+    V3 translationSum = {};
+    for (i32 i = 0; i < count; i++)
+    {
+        M4x4* fwd = &estimations[i].fwd;
+        Quaternion q = quaternionFromM4x4(fwd);
+        
+        r32 dot = q.x * first.x + q.y * first.y + q.z * first.z + q.w * first.w;
+        r32 sign = (dot < 0.0f) ? -1.0f : 1.0f;
+        sum.x += sign * q.x;
+        sum.y += sign * q.y;
+        sum.z += sign * q.z;
+        sum.w += sign * q.w;
+        
+        translationSum = addV3(translationSum,
+                               v3(fwd->e[3][0], fwd->e[3][1], fwd->e[3][2]));
+    }
+    
+    r32 length = sqrtf(sum.x * sum.x + sum.y * sum.y +
+                       sum.z * sum.z + sum.w * sum.w);
+    Quaternion mean = {sum.x / length, sum.y / length, sum.z / length, sum.w / length};
+    V3 t = multV3R(translationSum, 1.0f / (r32)count);
+    
+    result.fwd = rotationM4x4FromQuaternion(mean);
+    result.inv = identityM4x4();
+    for (i32 col = 0; col < 3; col++)
+    {
+        for (i32 row = 0; row < 3; row++)
+        {
+            // NOTE(jan): inverse of rotation matrix is its transpose
+            result.inv.e[row][col] = result.fwd.e[col][row];
+        }
+    }
+    
+    for (i32 row = 0; row < 3; row++)
+    {
+        result.fwd.e[3][row] = t.e[row];
+        result.inv.e[3][row] = -1.0f * (result.inv.e[0][row] * t.x +
+                                        result.inv.e[1][row] * t.y +
+                                        result.inv.e[2][row] * t.z);
+    }
+    
+    // NOTE(jan): how far the single estimations are off the average, a
+    // large spread means the board or the camera moved
+    r32 maxAngle = 0.0f;
+    r32 maxDistance = 0.0f;
+    for (i32 i = 0; i < count; i++)
+    {
+        M4x4* fwd = &estimations[i].fwd;
+        Quaternion q = quaternionFromM4x4(fwd);
+        r32 dot = fabsf(q.x * mean.x + q.y * mean.y + q.z * mean.z + q.w * mean.w);
+        r32 angle = 2.0f * acosf(fminf(dot, 1.0f));
+        r32 distance = lengthV3(subV3(v3(fwd->e[3][0], fwd->e[3][1], fwd->e[3][2]), t));
+        
+        maxAngle = fmaxf(maxAngle, angle);
+        maxDistance = fmaxf(maxDistance, distance);
+    }
+    printf("Pose estimation spread: %.3f deg, %.3f cm\n",
+           grad(maxAngle),
+           maxDistance);
+    
+    return result;
+}
+
+static void poseWorker(PoseEstimator* estimator)
+{
+    std::unique_lock<std::mutex> lock(estimator->mutex);
+    while (1)
+    {
+        while (estimator->running && !estimator->frameQueued)
+        {
+            estimator->wakeWorker.wait(lock);
+        }
+        
+        if (!estimator->running)
+        {
+            break;
+        }
+        
+        estimator->frameQueued = 0;
+        estimator->busy = 1;
+        Calibration calibration = estimator->calibration;
+        u32 generation = estimator->generation;
+        lock.unlock();
+        
+        M4x4inv cTw = {};
+        bool32 poseEstimated = CV_estimatePose(&estimator->arena,
+                                               &calibration,
+                                               &estimator->frame,
+                                               &cTw);
+        flushMemory(&estimator->arena);
+        
+        lock.lock();
+        estimator->busy = 0;
+        
+        // NOTE(jan): the estimation could have been restarted meanwhile,
+        // the result then belongs to the old calibration
+        if (poseEstimated && estimator->active && !estimator->finished &&
+            estimator->generation == generation)
+        {
+            estimator->estimations[estimator->estimationCount++] = cTw;
+            
+            printf("Pose estimation %i\n", estimator->estimationCount);
+            printM4x4(&cTw.inv);
+            printf("-------------------\n");
+            
+            if (estimator->estimationCount >= POSE_ESTIMATION_COUNT)
+            {
+                estimator->result = averagePoseEstimations(estimator->estimations,
+                                                           estimator->estimationCount);
+                estimator->finished = 1;
+            }
+        }
+    }
+}
+
+static void startPoseEstimator(MemoryArena* arena,
+                               PoseEstimator* estimator,
+                               i32 width,
+                               i32 height)
+{
+    estimator->frame = initializeFrame(arena, width, height, 1);
+    initMemoryArena(&estimator->arena,
+                    megabytes(1),
+                    pushSize(arena, megabytes(1)));
+    
+    estimator->running = 1;
+    estimator->frameQueued = 0;
+    estimator->busy = 0;
+    estimator->active = 0;
+    estimator->estimationCount = 0;
+    estimator->finished = 0;
+    estimator->generation = 0;
+    
+    estimator->worker = std::thread(poseWorker, estimator);
+}
+
+static void stopPoseEstimator(PoseEstimator* estimator)
+{
+    estimator->mutex.lock();
+    estimator->running = 0;
+    estimator->mutex.unlock();
+    estimator->wakeWorker.notify_one();
+    
+    estimator->worker.join();
+}
+
+static void restartPoseEstimation(PoseEstimator* estimator,
+                                  Calibration* calibration)
+{
+    std::lock_guard<std::mutex> lock(estimator->mutex);
+    estimator->calibration = *calibration;
+    estimator->active = 1;
+    estimator->estimationCount = 0;
+    estimator->finished = 0;
+    estimator->generation++;
+}
+
+// NOTE(jan): the frame is only copied if the worker is idle, otherwise
+// it is dropped and the worker gets a later one. Cropped frames don't
+// show the whole board and are skipped.
+static void submitPoseFrame(PoseEstimator* estimator,
+                            Frame* frame)
+{
+    if (frame->width != estimator->frame.width ||
+        frame->height != estimator->frame.height)
+    {
+        return;
+    }
+    
+    std::unique_lock<std::mutex> lock(estimator->mutex);
+    if (!estimator->active || estimator->finished ||
+        estimator->busy || estimator->frameQueued)
+    {
+        return;
+    }
+    
+    u8* dst = (u8*)estimator->frame.memory;
+    u8* src = (u8*)frame->memory;
+    for (i32 y = 0; y < frame->height; y++)
+    {
+        memcpy(dst, src, frame->width);
+        dst += estimator->frame.pitch;
+        src += frame->pitch;
+    }
+    estimator->frame.timestampUs = frame->timestampUs;
+    estimator->frame.sequence = frame->sequence;
+    
+    estimator->frameQueued = 1;
+    lock.unlock();
+    estimator->wakeWorker.notify_one();
+}
+
+// NOTE(jan): returns 1 once, when enough estimations were averaged
+static bool32 getEstimatedPose(PoseEstimator* estimator,
+                               M4x4inv* cTw)
+{
+    bool32 result = 0;
+    
+    std::lock_guard<std::mutex> lock(estimator->mutex);
+    if (estimator->active && estimator->finished)
+    {
+        *cTw = estimator->result;
+        estimator->active = 0;
+        result = 1;
+    }
+    
+    return result;
+}
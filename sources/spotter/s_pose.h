@@ -0,0 +1,29 @@
+#ifndef S_POSE_H
+
+// NOTE(jan): pose estimation takes far longer than a frame, it runs on a
+// thread of its own and always gets the latest frame that arrived while
+// it was busy. Frames that come in while it is working are not queued.
+struct PoseEstimator
+{
+    Calibration calibration;
+    MemoryArena arena;
+    Frame frame; // copy the worker owns while it is busy
+    M4x4inv estimations[POSE_ESTIMATION_COUNT];
+    
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeWorker;
+    bool32 running;
+    
+    // NOTE(jan): guarded by mutex
+    bool32 frameQueued;
+    bool32 busy;
+    bool32 active;
+    i32 estimationCount;
+    bool32 finished;
+    M4x4inv result;
+    u32 generation; // bumped by every restart
+};
+
+#define S_POSE_H
+#endif
@@ -0,0 +1,992 @@
+#include "s_recording.h"
+
+static const char* recordingEncodingNames[RecordingEncoding_Count] = {
+    "raw", "rle", "delta"
+};
+
+static bool32 parseRecordingEncoding(const char* name,
+                                     RecordingEncoding* encoding)
+{
+    for (i32 encodingIndex = 0;
+         encodingIndex < RecordingEncoding_Count;
+         encodingIndex++)
+    {
+        if (strcmp(name, recordingEncodingNames[encodingIndex]) == 0)
+        {
+            *encoding = (RecordingEncoding)encodingIndex;
+            return 1;
+        }
+    }
+    
+    printf("Unknown recording encoding %s, use raw, rle or delta\n", name);
+    return 0;
+}
+
+// NOTE(jan): the encoders return the encoded size, or 0 if it would not
+// fit into capacity. Rows are stored without padding.
+static u32 encodeFrameRaw(Frame* frame,
+                          u8* output,
+                          u32 capacity)
+{
+    u32 rowSize = frame->width;
+    if (rowSize * frame->height > capacity)
+    {
+        return 0;
+    }
+    
+    u8* row = (u8*)frame->memory;
+    for (i32 y = 0; y < frame->height; y++)
+    {
+        memcpy(output + y * rowSize, row, rowSize);
+        row += frame->pitch;
+    }
+    
+    return rowSize * frame->height;
+}
+
+// NOTE(jan): every row is a u16 run count followed by its runs, each a
+// u16 start x, a u16 length and the pixels of the run
+static u32 encodeFrameRunLength(Frame* frame,
+                                u8 threshold,
+                                u8* output,
+                                u32 capacity)
+{
+    u8* out = output;
+    u8* end = output + capacity;
+    
+    u8* row = (u8*)frame->memory;
+    for (i32 y = 0; y < frame->height; y++)
+    {
+        if (end - out < 2)
+        {
+            return 0;
+        }
+        u8* runCountPosition = out;
+        out += 2;
+        
+        u16 runCount = 0;
+        i32 x = 0;
+        while (x < frame->width)
+        {
+            while (x < frame->width && row[x] <= threshold)
+            {
+                x++;
+            }
+            if (x == frame->width)
+            {
+                break;
+            }
+            
+            u16 startX = (u16)x;
+            while (x < frame->width && row[x] > threshold)
+            {
+                x++;
+            }
+            u16 length = (u16)(x - startX);
+            
+            if (end - out < 4 + length)
+            {
+                return 0;
+            }
+            memcpy(out, &startX, 2);
+            memcpy(out + 2, &length, 2);
+            memcpy(out + 4, row + startX, length);
+            out += 4 + length;
+            runCount++;
+        }
+        
+        memcpy(runCountPosition, &runCount, 2);
+        row += frame->pitch;
+    }
+    
+    return (u32)(out - output);
+}
+
+// NOTE(jan): residuals are packed like packbits. A control byte below 128
+// is followed by that many + 1 literal residuals, one of 128 and above
+// by a single residual that repeats control - 125 times.
+static u32 encodeFrameDelta(Frame* frame,
+                            u8* residuals,
+                            u8* output,
+                            u32 capacity)
+{
+    u8* out = output;
+    u8* end = output + capacity;
+    
+    u8* row = (u8*)frame->memory;
+    u8 rowPrediction = 0;
+    for (i32 y = 0; y < frame->height; y++)
+    {
+        // NOTE(jan): the first pixel is predicted from the one above
+        residuals[0] = row[0] - rowPrediction;
+        for (i32 x = 1; x < frame->width; x++)
+        {
+            residuals[x] = row[x] - row[x - 1];
+        }
+        rowPrediction = row[0];
+        
+        i32 x = 0;
+        while (x < frame->width)
+        {
+            i32 runLength = 1;
+            while (x + runLength < frame->width &&
+                   runLength < 130 &&
+                   residuals[x + runLength] == residuals[x])
+            {
+                runLength++;
+            }
+            
+            if (runLength >= 3)
+            {
+                if (end - out < 2)
+                {
+                    return 0;
+                }
+                out[0] = (u8)(runLength - 3 + 128);
+                out[1] = residuals[x];
+                out += 2;
+                x += runLength;
+            }
+            else
+            {
+                i32 literalCount = 0;
+                while (x + literalCount < frame->width &&
+                       literalCount < 128)
+                {
+                    i32 next = x + literalCount;
+                    if (next + 2 < frame->width &&
+                        residuals[next] == residuals[next + 1] &&
+                        residuals[next] == residuals[next + 2])
+                    {
+                        break;
+                    }
+                    literalCount++;
+                }
+                
+                if (end - out < 1 + literalCount)
+                {
+                    return 0;
+                }
+                out[0] = (u8)(literalCount - 1);
+                memcpy(out + 1, residuals + x, literalCount);
+                out += 1 + literalCount;
+                x += literalCount;
+            }
+        }
+        
+        row += frame->pitch;
+    }
+    
+    return (u32)(out - output);
+}
+
+// NOTE(jan): output needs room for the frame at its pitch. Returns 0 if
+// the encoded data is broken.
+static bool32 decodeRecordingFrame(RecordingFrameHeader* frameHeader,
+                                   u8* data,
+                                   Frame* output)
+{
+    if (frameHeader->width > output->pitch ||
+        frameHeader->height * output->pitch > output->size)
+    {
+        printf("Recorded frame of %i x %i does not fit\n",
+               frameHeader->width, frameHeader->height);
+        return 0;
+    }
+    
+    output->width = frameHeader->width;
+    output->height = frameHeader->height;
+    output->originX = frameHeader->originX;
+    output->originY = frameHeader->originY;
+    output->timestampUs = frameHeader->timestampUs;
+    output->sequence = frameHeader->sequence;
+    
+    u8* in = data;
+    u8* end = data + frameHeader->encodedSize;
+    u8* row = (u8*)output->memory;
+    i32 width = frameHeader->width;
+    
+    switch (frameHeader->encoding)
+    {
+        case RecordingEncoding_Raw:
+        {
+            if (end - in < width * frameHeader->height)
+            {
+                return 0;
+            }
+            for (i32 y = 0; y < frameHeader->height; y++)
+            {
+                memcpy(row, in, width);
+                in += width;
+                row += output->pitch;
+            }
+        } break;
+        
+        case RecordingEncoding_RunLength:
+        {
+            for (i32 y = 0; y < frameHeader->height; y++)
+            {
+                memset(row, 0, width);
+                
+                u16 runCount;
+                if (end - in < 2)
+                {
+                    return 0;
+                }
+                memcpy(&runCount, in, 2);
+                in += 2;
+                
+                for (u16 runIndex = 0; runIndex < runCount; runIndex++)
+                {
+                    u16 startX;
+                    u16 length;
+                    if (end - in < 4)
+                    {
+                        return 0;
+                    }
+                    memcpy(&startX, in, 2);
+                    memcpy(&length, in + 2, 2);
+                    in += 4;
+                    
+                    if (end - in < length || startX + length > width)
+                    {
+                        return 0;
+                    }
+                    memcpy(row + startX, in, length);
+                    in += length;
+                }
+                
+                row += output->pitch;
+            }
+        } break;
+        
+        case RecordingEncoding_Delta:
+        {
+            u8 rowPrediction = 0;
+            for (i32 y = 0; y < frameHeader->height; y++)
+            {
+                // NOTE(jan): the first pixel of a row is predicted from
+                // the first one of the row above
+                i32 x = 0;
+                u8 prediction = rowPrediction;
+                while (x < width)
+                {
+                    if (end - in < 1)
+                    {
+                        return 0;
+                    }
+                    u8 control = *in++;
+                    
+                    if (control < 128)
+                    {
+                        i32 literalCount = control + 1;
+                        if (end - in < literalCount || x + literalCount > width)
+                        {
+                            return 0;
+                        }
+                        for (i32 i = 0; i < literalCount; i++)
+                        {
+                            prediction += in[i];
+                            row[x + i] = prediction;
+                        }
+                        in += literalCount;
+                        x += literalCount;
+                    }
+                    else
+                    {
+                        i32 runLength = control - 125;
+                        if (end - in < 1 || x + runLength > width)
+                        {
+                            return 0;
+                        }
+                        u8 residual = *in++;
+                        for (i32 i = 0; i < runLength; i++)
+                        {
+                            prediction += residual;
+                            row[x + i] = prediction;
+                        }
+                        x += runLength;
+                    }
+                }
+                
+                rowPrediction = row[0];
+                row += output->pitch;
+            }
+        } break;
+        
+        default:
+        {
+            printf("Unknown frame encoding %u\n", frameHeader->encoding);
+            return 0;
+        } break;
+    }
+    
+    return 1;
+}
+
+static bool32 writeRecordingData(i32 fileDescriptor,
+                                 u8* data,
+                                 u64 size)
+{
+    bool32 result = 1;
+    
+    while (size)
+    {
+        ssize_t bytesWritten = write(fileDescriptor, data, size);
+        if (bytesWritten == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            
+            printErrno();
+            result = 0;
+            break;
+        }
+        
+        size -= bytesWritten;
+        data += bytesWritten;
+    }
+    
+    return result;
+}
+
+// NOTE(jan): O_DIRECT keeps the recording out of the page cache, which
+// would otherwise fill up with frames nobody reads again and get flushed
+// in bursts. It needs memory, size and file offset aligned, so only whole
+// blocks are written and the rest stays in the staging memory, unless
+// the recording is closed. Nothing is advanced if the write fails.
+static bool32 flushRecordingStaging(Recorder* recorder,
+                                    bool32 flushAll)
+{
+    u32 size = recorder->stagingUsed;
+    if (!flushAll)
+    {
+        size -= size % RECORDING_DIRECT_IO_ALIGNMENT;
+    }
+    
+    if (!writeRecordingData(recorder->fileDescriptor, recorder->staging, size))
+    {
+        printf("Could not write the recording\n");
+        return 0;
+    }
+    
+    recorder->fileOffset += size;
+    recorder->stagingUsed -= size;
+    memmove(recorder->staging,
+            recorder->staging + size,
+            recorder->stagingUsed);
+    
+    return 1;
+}
+
+// NOTE(jan): only called by the writer, which owns the staging memory
+// while a recording is open. Returns the bytes the frame takes, 0 if
+// the staging memory couldn't be written.
+static u32 encodeRecordingFrame(Recorder* recorder,
+                                Frame* frame)
+{
+    RecordingHeader* header = &recorder->header;
+    u32 rawSize = frame->width * frame->height;
+    
+    if (recorder->stagingUsed + sizeof(RecordingFrameHeader) + rawSize >
+        recorder->stagingSize)
+    {
+        if (!flushRecordingStaging(recorder, 0))
+        {
+            return 0;
+        }
+    }
+    
+    RecordingFrameHeader frameHeader = {};
+    frameHeader.timestampUs = frame->timestampUs;
+    frameHeader.sequence = frame->sequence;
+    frameHeader.encoding = header->encoding;
+    frameHeader.originX = frame->originX;
+    frameHeader.originY = frame->originY;
+    frameHeader.width = frame->width;
+    frameHeader.height = frame->height;
+    
+    u64 frameOffset = recorder->fileOffset + recorder->stagingUsed;
+    u8* data = recorder->staging + recorder->stagingUsed + sizeof(frameHeader);
+    
+    // NOTE(jan): frames that would not get any smaller are stored raw
+    u32 encodedSize = 0;
+    switch (header->encoding)
+    {
+        case RecordingEncoding_RunLength:
+        {
+            encodedSize = encodeFrameRunLength(frame,
+                                               (u8)header->threshold,
+                                               data,
+                                               rawSize - 1);
+        } break;
+        
+        case RecordingEncoding_Delta:
+        {
+            encodedSize = encodeFrameDelta(frame,
+                                           recorder->residuals,
+                                           data,
+                                           rawSize - 1);
+        } break;
+    }
+    
+    if (!encodedSize)
+    {
+        frameHeader.encoding = RecordingEncoding_Raw;
+        encodedSize = encodeFrameRaw(frame, data, rawSize);
+    }
+    frameHeader.encodedSize = encodedSize;
+    
+    memcpy(recorder->staging + recorder->stagingUsed,
+           &frameHeader,
+           sizeof(frameHeader));
+    recorder->stagingUsed += sizeof(frameHeader) + encodedSize;
+    
+    // NOTE(jan): frames past the end of the index are still in the file,
+    // they can only be found by reading front to back
+    if (header->indexCount < RECORDING_MAX_INDEX_COUNT)
+    {
+        RecordingIndexEntry* entry = &recorder->index[header->indexCount++];
+        entry->offset = frameOffset;
+        entry->timestampUs = frame->timestampUs;
+    }
+    header->frameCount++;
+    
+    if (recorder->stagingUsed >= RECORDING_FLUSH_SIZE)
+    {
+        if (!flushRecordingStaging(recorder, 0))
+        {
+            return 0;
+        }
+    }
+    
+    return sizeof(frameHeader) + encodedSize;
+}
+
+static void recordingWorker(Recorder* recorder)
+{
+    std::unique_lock<std::mutex> lock(recorder->mutex);
+    while (1)
+    {
+        if (!recorder->pendingCount)
+        {
+            if (!recorder->running)
+            {
+                break;
+            }
+            
+            recorder->wakeWriter.wait(lock);
+            continue;
+        }
+        
+        RecordingSlot* slot = &recorder->slots[recorder->readIndex];
+        bool32 writeFailed = recorder->stats.writeFailed;
+        lock.unlock();
+        
+        // NOTE(jan): after a failed write the frames still queued are
+        // only given back
+        u32 size = 0;
+        if (!writeFailed)
+        {
+            size = encodeRecordingFrame(recorder, &slot->frame);
+        }
+        
+        if (slot->captureBufferIndex != -1)
+        {
+            releaseFrame(recorder->captureState, slot->captureBufferIndex);
+        }
+        
+        lock.lock();
+        if (slot->captureBufferIndex != -1)
+        {
+            recorder->pinnedCount--;
+        }
+        recorder->readIndex = (recorder->readIndex + 1) % recorder->slotCount;
+        recorder->pendingCount--;
+        if (size)
+        {
+            recorder->stats.recordedCount++;
+            recorder->stats.bytesWritten += size;
+            recorder->stats.rawBytes += slot->frame.width * slot->frame.height;
+        }
+        else
+        {
+            recorder->stats.droppedCount++;
+            recorder->stats.writeFailed = 1;
+        }
+        recorder->slotFreed.notify_all();
+    }
+}
+
+// NOTE(jan): frames that are not capture buffers need copy memory, which
+// is only allocated if copyFrames is set
+static void startRecorder(MemoryArena* arena,
+                          Recorder* recorder,
+                          CaptureState* captureState,
+                          i32 maxWidth,
+                          i32 maxHeight,
+                          bool32 copyFrames)
+{
+    u32 maxFrameSize = maxWidth * maxHeight;
+    
+    recorder->captureState = captureState;
+    recorder->slotCount = RECORDING_SLOT_COUNT;
+    recorder->copySize = copyFrames ? maxFrameSize : 0;
+    recorder->fileDescriptor = -1;
+    recorder->readIndex = 0;
+    recorder->pendingCount = 0;
+    recorder->pinnedCount = 0;
+    recorder->stats = {};
+    
+    for (u32 slotIndex = 0; slotIndex < recorder->slotCount; slotIndex++)
+    {
+        RecordingSlot* slot = &recorder->slots[slotIndex];
+        *slot = {};
+        slot->captureBufferIndex = -1;
+        if (copyFrames)
+        {
+            slot->copyMemory = (u8*)pushSize(arena, maxFrameSize);
+        }
+    }
+    
+    // NOTE(jan): a whole raw frame has to fit behind the unwritten rest
+    // of a block and before the flush size is reached
+    u32 stagingSize = (RECORDING_FLUSH_SIZE + RECORDING_DIRECT_IO_ALIGNMENT +
+                       sizeof(RecordingFrameHeader) + maxFrameSize);
+    stagingSize += RECORDING_DIRECT_IO_ALIGNMENT - 1;
+    stagingSize -= stagingSize % RECORDING_DIRECT_IO_ALIGNMENT;
+    recorder->stagingSize = stagingSize;
+    recorder->staging = (u8*)pushSizeAligned(arena,
+                                             stagingSize,
+                                             RECORDING_DIRECT_IO_ALIGNMENT);
+    recorder->index =
+        (RecordingIndexEntry*)pushSize(arena,
+                                       RECORDING_MAX_INDEX_COUNT *
+                                       sizeof(RecordingIndexEntry));
+    recorder->residuals = (u8*)pushSize(arena, maxWidth);
+    
+    recorder->running = 1;
+    recorder->writer = std::thread(recordingWorker, recorder);
+}
+
+// NOTE(jan): waits until every queued frame is written and all pinned
+// capture buffers are back with the driver
+static void waitForRecorder(Recorder* recorder)
+{
+    std::unique_lock<std::mutex> lock(recorder->mutex);
+    while (recorder->pendingCount)
+    {
+        recorder->slotFreed.wait(lock);
+    }
+}
+
+static RecorderStats getRecorderStats(Recorder* recorder)
+{
+    recorder->mutex.lock();
+    RecorderStats result = recorder->stats;
+    result.backlog = recorder->pendingCount;
+    recorder->mutex.unlock();
+    
+    return result;
+}
+
+static void printRecorderStats(RecorderStats* stats)
+{
+    r32 compression = 0.0f;
+    if (stats->bytesWritten)
+    {
+        compression = (r32)stats->rawBytes / (r32)stats->bytesWritten;
+    }
+    
+    printf("recording: %" PRIu64 " frames, %" PRIu64 " KB written (%.1fx smaller), "
+           "%" PRIu64 " dropped, backlog %u (max %u)\n",
+           stats->recordedCount,
+           stats->bytesWritten / 1024,
+           compression,
+           stats->droppedCount,
+           stats->backlog,
+           stats->maxBacklog);
+    if (stats->writeFailed)
+    {
+        printf("recording: stopped after a failed write, the file is incomplete\n");
+    }
+}
+
+// NOTE(jan): writes the rest of the frames, the index and the final
+// header. Blocks until the writer is done.
+static void closeRecording(Recorder* recorder)
+{
+    waitForRecorder(recorder);
+    
+    recorder->mutex.lock();
+    i32 fileDescriptor = recorder->fileDescriptor;
+    bool32 directIo = recorder->directIo;
+    RecorderStats stats = recorder->stats;
+    recorder->mutex.unlock();
+    
+    if (fileDescriptor == -1)
+    {
+        return;
+    }
+    
+    // NOTE(jan): the end of the file isn't a whole block
+    if (directIo)
+    {
+        i32 flags = fcntl(fileDescriptor, F_GETFL);
+        fcntl(fileDescriptor, F_SETFL, flags & ~O_DIRECT);
+    }
+    
+    // NOTE(jan): after a failed write the file is left as it is, the
+    // header is only written if everything before it made it to disk
+    RecordingHeader* header = &recorder->header;
+    if (!stats.writeFailed &&
+        flushRecordingStaging(recorder, 1))
+    {
+        header->indexOffset = recorder->fileOffset;
+        if (!writeRecordingData(fileDescriptor,
+                                (u8*)recorder->index,
+                                header->indexCount * sizeof(RecordingIndexEntry)) ||
+            pwrite(fileDescriptor, header, sizeof(*header), 0) != sizeof(*header))
+        {
+            printErrno();
+            stats.writeFailed = 1;
+        }
+    }
+    else
+    {
+        stats.writeFailed = 1;
+    }
+    
+    closeFile(fileDescriptor);
+    printRecorderStats(&stats);
+    
+    recorder->mutex.lock();
+    recorder->fileDescriptor = -1;
+    recorder->mutex.unlock();
+}
+
+// NOTE(jan): width and height are the full frame size, threshold is only
+// used by the run length encoding
+static bool32 openRecording(Recorder* recorder,
+                            const char* filename,
+                            i32 width,
+                            i32 height,
+                            RecordingEncoding encoding,
+                            u8 threshold)
+{
+    closeRecording(recorder);
+    
+    bool32 directIo = 1;
+    i32 fileDescriptor = open(filename,
+                              O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT,
+                              S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fileDescriptor == -1 && errno == EINVAL)
+    {
+        // NOTE(jan): e.g. tmpfs has no direct i/o
+        directIo = 0;
+        fileDescriptor = openFileForWriting(filename);
+    }
+    
+    if (fileDescriptor == -1)
+    {
+        printf("Could not open recording %s\n", filename);
+        printErrno();
+        return 0;
+    }
+    
+    printf("Recording %s frames to %s\n",
+           recordingEncodingNames[encoding],
+           filename);
+    
+    // NOTE(jan): the writer is idle, there is nothing pending
+    RecordingHeader* header = &recorder->header;
+    *header = {};
+    header->magic = RECORDING_MAGIC;
+    header->version = RECORDING_VERSION;
+    header->width = width;
+    header->height = height;
+    header->encoding = encoding;
+    header->threshold = threshold;
+    
+    // NOTE(jan): the header gets a block of its own, so the frames start
+    // aligned
+    memset(recorder->staging, 0, RECORDING_DIRECT_IO_ALIGNMENT);
+    memcpy(recorder->staging, header, sizeof(*header));
+    recorder->stagingUsed = RECORDING_DIRECT_IO_ALIGNMENT;
+    recorder->fileOffset = 0;
+    
+    recorder->mutex.lock();
+    recorder->fileDescriptor = fileDescriptor;
+    recorder->directIo = directIo;
+    recorder->stats = {};
+    recorder->mutex.unlock();
+    
+    return 1;
+}
+
+// NOTE(jan): never blocks on the disk. A frame handed out by readFrame is
+// pinned instead of copied, the caller's requeueBuffer leaves it to the
+// writer then. If the backlog is full the frame is dropped.
+static bool32 recordFrame(Recorder* recorder,
+                          Frame* frame)
+{
+    assert(frame->bytesPerPixel == 1);
+    
+    CaptureState* captureState = recorder->captureState;
+    bool32 isCaptureBuffer = 
+        (captureState &&
+         captureState->readBufferIndex != -1 &&
+         frame == &captureState->buffers[captureState->readBufferIndex]);
+    u32 size = frame->pitch * frame->height;
+    
+    std::unique_lock<std::mutex> lock(recorder->mutex);
+    
+    if (recorder->fileDescriptor == -1 ||
+        recorder->stats.writeFailed)
+    {
+        return 0;
+    }
+    
+    if (recorder->pendingCount >= recorder->slotCount ||
+        (isCaptureBuffer && recorder->pinnedCount >= RECORDING_MAX_PINNED_COUNT) ||
+        (!isCaptureBuffer && size > recorder->copySize))
+    {
+        recorder->stats.droppedCount++;
+        return 0;
+    }
+    
+    // NOTE(jan): only this thread adds frames, the slot stays free while
+    // the lock is released for the copy
+    u32 writeIndex =
+        (recorder->readIndex + recorder->pendingCount) % recorder->slotCount;
+    RecordingSlot* slot = &recorder->slots[writeIndex];
+    slot->frame = *frame;
+    
+    if (isCaptureBuffer)
+    {
+        slot->captureBufferIndex = pinFrame(captureState);
+        recorder->pinnedCount++;
+    }
+    else
+    {
+        lock.unlock();
+        memcpy(slot->copyMemory, frame->memory, size);
+        lock.lock();
+        
+        slot->frame.memory = slot->copyMemory;
+        slot->frame.size = size;
+        slot->captureBufferIndex = -1;
+    }
+    
+    recorder->pendingCount++;
+    if (recorder->pendingCount > recorder->stats.maxBacklog)
+    {
+        recorder->stats.maxBacklog = recorder->pendingCount;
+    }
+    
+    lock.unlock();
+    recorder->wakeWriter.notify_one();
+    
+    return 1;
+}
+
+// NOTE(jan): writes everything still queued up and joins the writer
+static void stopRecorder(Recorder* recorder)
+{
+    closeRecording(recorder);
+    
+    recorder->mutex.lock();
+    recorder->running = 0;
+    recorder->mutex.unlock();
+    recorder->wakeWriter.notify_one();
+    
+    if (recorder->writer.joinable())
+    {
+        recorder->writer.join();
+    }
+}
+
+// NOTE(jan): the spotter puts the frame size into the names of its
+// recordings, e.g. debug_frames_1640x1232_<time>.spot, which is all old
+// recordings without a header have
+static bool32 getRecordingFrameSizeFromName(const char* filename,
+                                            i32* width,
+                                            i32* height)
+{
+    bool32 result = 0;
+    
+    const char* sizeString = strstr(filename, "debug_frames_");
+    if (sizeString &&
+        sscanf(sizeString, "debug_frames_%ix%i_", width, height) == 2)
+    {
+        result = 1;
+    }
+    
+    return result;
+}
+
+static bool32 openRecordingReader(RecordingReader* reader,
+                                  void* content,
+                                  u64 contentSize,
+                                  i32 legacyWidth,
+                                  i32 legacyHeight)
+{
+    *reader = {};
+    reader->content = (u8*)content;
+    reader->contentSize = contentSize;
+    
+    RecordingHeader* header = &reader->header;
+    if (contentSize >= sizeof(RecordingHeader))
+    {
+        memcpy(header, content, sizeof(RecordingHeader));
+    }
+    
+    if (header->magic == RECORDING_MAGIC)
+    {
+        if (header->version != RECORDING_VERSION)
+        {
+            printf("Recording version %u is not supported\n", header->version);
+            return 0;
+        }
+        
+        reader->nextOffset = RECORDING_DIRECT_IO_ALIGNMENT;
+    }
+    else
+    {
+        if (legacyWidth <= 0 || legacyHeight <= 0)
+        {
+            printf("Recording has no header and no frame size is given\n");
+            return 0;
+        }
+        
+        reader->isLegacy = 1;
+        *header = {};
+        header->width = legacyWidth;
+        header->height = legacyHeight;
+        header->encoding = RecordingEncoding_Raw;
+        header->frameCount = (u32)(contentSize / (legacyWidth * legacyHeight));
+    }
+    
+    return 1;
+}
+
+// NOTE(jan): header and encoded data of the frame at the read position,
+// without moving on. Returns 0 at the end of the recording.
+static bool32 peekRecordingFrame(RecordingReader* reader,
+                                 RecordingFrameHeader* frameHeader,
+                                 u8** data)
+{
+    *frameHeader = {};
+    
+    if (reader->isLegacy)
+    {
+        frameHeader->width = reader->header.width;
+        frameHeader->height = reader->header.height;
+        frameHeader->encoding = RecordingEncoding_Raw;
+        frameHeader->encodedSize = frameHeader->width * frameHeader->height;
+        
+        if (reader->nextOffset + frameHeader->encodedSize > reader->contentSize)
+        {
+            return 0;
+        }
+        *data = reader->content + reader->nextOffset;
+    }
+    else
+    {
+        u64 endOffset = reader->contentSize;
+        if (reader->header.indexOffset &&
+            reader->header.indexOffset < endOffset)
+        {
+            endOffset = reader->header.indexOffset;
+        }
+        
+        if (reader->nextOffset + sizeof(*frameHeader) > endOffset)
+        {
+            return 0;
+        }
+        memcpy(frameHeader,
+               reader->content + reader->nextOffset,
+               sizeof(*frameHeader));
+        
+        // NOTE(jan): the last frame of a recording that was cut short
+        if (reader->nextOffset + sizeof(*frameHeader) + frameHeader->encodedSize > endOffset)
+        {
+            return 0;
+        }
+        *data = reader->content + reader->nextOffset + sizeof(*frameHeader);
+    }
+    
+    return 1;
+}
+
+static void skipRecordingFrame(RecordingReader* reader,
+                               RecordingFrameHeader* frameHeader,
+                               u8* data)
+{
+    reader->nextOffset = (data - reader->content) + frameHeader->encodedSize;
+}
+
+// NOTE(jan): decodes the frame at the read position into output and moves
+// on to the next one. Returns 0 at the end of the recording.
+static bool32 readNextRecordingFrame(RecordingReader* reader,
+                                     Frame* output)
+{
+    RecordingFrameHeader frameHeader;
+    u8* data;
+    if (!peekRecordingFrame(reader, &frameHeader, &data) ||
+        !decodeRecordingFrame(&frameHeader, data, output))
+    {
+        return 0;
+    }
+    
+    skipRecordingFrame(reader, &frameHeader, data);
+    
+    return 1;
+}
+
+// NOTE(jan): uses the index if the recording has one, otherwise the
+// frame headers are walked from the start
+static bool32 seekRecordingFrame(RecordingReader* reader,
+                                 u32 frameIndex)
+{
+    if (reader->isLegacy)
+    {
+        if (frameIndex >= reader->header.frameCount)
+        {
+            return 0;
+        }
+        reader->nextOffset =
+            (u64)frameIndex * reader->header.width * reader->header.height;
+        return 1;
+    }
+    
+    if (frameIndex < reader->header.indexCount &&
+        reader->header.indexOffset +
+        reader->header.indexCount * sizeof(RecordingIndexEntry) <= reader->contentSize)
+    {
+        RecordingIndexEntry entry;
+        memcpy(&entry,
+               reader->content + reader->header.indexOffset +
+               frameIndex * sizeof(RecordingIndexEntry),
+               sizeof(entry));
+        reader->nextOffset = entry.offset;
+        return 1;
+    }
+    
+    u64 offset = RECORDING_DIRECT_IO_ALIGNMENT;
+    for (u32 index = 0; index < frameIndex; index++)
+    {
+        RecordingFrameHeader frameHeader;
+        if (offset + sizeof(frameHeader) > reader->contentSize)
+        {
+            return 0;
+        }
+        memcpy(&frameHeader, reader->content + offset, sizeof(frameHeader));
+        offset += sizeof(frameHeader) + frameHeader.encodedSize;
+    }
+    reader->nextOffset = offset;
+    
+    return 1;
+}
@@ -0,0 +1,136 @@
+#ifndef S_RECORDING_H
+
+// NOTE(jan): capture buffers the recorder may hold at once, the capture
+// thread needs the rest to keep up with the camera
+#define RECORDING_MAX_PINNED_COUNT (CAPTURE_BUFFER_COUNT - 4)
+#define RECORDING_SLOT_COUNT 4
+#define RECORDING_DIRECT_IO_ALIGNMENT 4096
+
+#define RECORDING_MAGIC 0x544f5053 // "SPOT"
+#define RECORDING_VERSION 1
+#define RECORDING_DEFAULT_THRESHOLD 32
+#define RECORDING_MAX_INDEX_COUNT 65536
+#define RECORDING_FLUSH_SIZE kilobytes(256)
+
+enum RecordingEncoding
+{
+    RecordingEncoding_Raw,
+    // NOTE(jan): only the runs of pixels above the threshold are kept,
+    // everything else comes back black. Lossy, but blob extraction at
+    // any threshold at or above the recording's gives the same result.
+    RecordingEncoding_RunLength,
+    // NOTE(jan): lossless, every pixel is predicted from its left
+    // neighbour and the residuals are packed
+    RecordingEncoding_Delta,
+    RecordingEncoding_Count
+};
+
+// NOTE(jan): a recording starts with this header in a block of its own,
+// followed by the frames, each a RecordingFrameHeader and its encoded
+// pixels, and ends with the index. indexOffset and the counts are only
+// filled in when the recording is closed, a file that was cut short
+// still reads front to back.
+struct RecordingHeader
+{
+    u32 magic;
+    u32 version;
+    i32 width; // full sensor frame, frames can be cropped
+    i32 height;
+    u32 encoding;
+    u32 threshold;
+    u32 frameCount;
+    u32 indexCount;
+    u64 indexOffset;
+};
+
+// NOTE(jan): frames that don't get smaller with the recording's encoding
+// are stored raw, so the encoding is set per frame
+struct RecordingFrameHeader
+{
+    u64 timestampUs;
+    u32 sequence;
+    u32 encoding;
+    u32 encodedSize;
+    i32 originX;
+    i32 originY;
+    i32 width;
+    i32 height;
+};
+
+struct RecordingIndexEntry
+{
+    u64 offset; // of the frame header
+    u64 timestampUs;
+};
+
+// NOTE(jan): a frame waiting to be written. Capture buffers are pinned
+// and written straight from the driver's memory, anything else (e.g. the
+// luma plane converted from yuyv) is copied into the slot's own memory.
+struct RecordingSlot
+{
+    Frame frame;
+    i32 captureBufferIndex; // -1 if the frame was copied
+    u8* copyMemory;
+};
+
+struct RecorderStats
+{
+    u64 recordedCount;
+    u64 droppedCount;
+    u64 bytesWritten;
+    u64 rawBytes; // what the frames would have taken unencoded
+    u32 backlog; // frames queued but not written yet
+    u32 maxBacklog;
+    bool32 writeFailed; // no more frames are taken until it is reopened
+};
+
+// NOTE(jan): frames are encoded and written by a thread of their own,
+// recording never makes the tracking loop wait for the disk. If the disk
+// can't keep up, frames are dropped and counted.
+struct Recorder
+{
+    CaptureState* captureState;
+    
+    RecordingSlot slots[RECORDING_SLOT_COUNT];
+    u32 slotCount;
+    u32 copySize;
+    
+    // NOTE(jan): encoded frames are collected here and written out in
+    // aligned blocks, owned by the writer while a recording is open
+    u8* staging;
+    u32 stagingSize;
+    u32 stagingUsed;
+    u64 fileOffset; // of the start of the staging memory
+    RecordingHeader header;
+    RecordingIndexEntry* index;
+    u8* residuals; // one row, for the delta encoding
+    
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wakeWriter;
+    std::condition_variable slotFreed;
+    bool32 running;
+    
+    // NOTE(jan): guarded by mutex
+    i32 fileDescriptor;
+    bool32 directIo;
+    u32 readIndex;
+    u32 pendingCount;
+    u32 pinnedCount;
+    RecorderStats stats;
+};
+
+// NOTE(jan): reads recordings that are in memory as a whole. Old
+// recordings without a header are raw frames back to back, their frame
+// size has to come from somewhere else, e.g. the file name.
+struct RecordingReader
+{
+    u8* content;
+    u64 contentSize;
+    RecordingHeader header;
+    bool32 isLegacy;
+    u64 nextOffset;
+};
+
+#define S_RECORDING_H
+#endif
@@ -0,0 +1,186 @@
+#include "s_replay.h"
+
+static void seekReplay(ReplayState* replay,
+                       u32 frameIndex)
+{
+    if (seekRecordingFrame(&replay->reader, frameIndex))
+    {
+        replay->frameIndex = frameIndex;
+    }
+    else
+    {
+        printf("Recording has no frame %u\n", frameIndex);
+        seekRecordingFrame(&replay->reader, 0);
+        replay->frameIndex = 0;
+    }
+    
+    replay->clockStarted = 0;
+    replay->finished = 0;
+}
+
+// NOTE(jan): legacyWidth and legacyHeight are only used for recordings
+// without a header whose name doesn't tell their frame size
+static bool32 startReplay(MemoryArena* arena,
+                          CaptureState* state,
+                          ReplayState* replay,
+                          const char* filename,
+                          i32 legacyWidth,
+                          i32 legacyHeight,
+                          r32 speed,
+                          bool32 loop)
+{
+    *replay = {};
+    replay->speed = speed;
+    replay->loop = loop;
+    
+    if (!mapEntireFile(filename, &replay->file))
+    {
+        return 0;
+    }
+    
+    // NOTE(jan): frames are read front to back
+    madvise(replay->file.content, replay->file.contentSize, MADV_SEQUENTIAL);
+    
+    getRecordingFrameSizeFromName(filename, &legacyWidth, &legacyHeight);
+    if (!openRecordingReader(&replay->reader,
+                             replay->file.content,
+                             replay->file.contentSize,
+                             legacyWidth,
+                             legacyHeight))
+    {
+        unmapFile(&replay->file);
+        return 0;
+    }
+    
+    RecordingHeader* header = &replay->reader.header;
+    replay->frame = initializeFrame(arena, header->width, header->height, 1);
+    replay->decodeMemory = (u8*)replay->frame.memory;
+    
+    printf("Replaying %s, %i x %i, %u frames%s\n",
+           filename,
+           header->width,
+           header->height,
+           header->frameCount,
+           header->indexOffset || replay->reader.isLegacy ? "" : " (no index)");
+    
+    state->backend = CaptureBackend_Replay;
+    state->replay = replay;
+    state->fd = -1;
+    state->readBufferIndex = -1;
+    state->latestBufferIndex = -1;
+    state->config = getDefaultCaptureConfig();
+    state->config.width = header->width;
+    state->config.height = header->height;
+    state->cropWidth = header->width;
+    state->cropHeight = header->height;
+    
+    return 1;
+}
+
+static bool32 readReplayFrame(ReplayState* replay,
+                              Frame** outputFrame)
+{
+    RecordingFrameHeader frameHeader;
+    u8* data;
+    if (!peekRecordingFrame(&replay->reader, &frameHeader, &data))
+    {
+        if (!replay->loop || replay->frameIndex == 0)
+        {
+            if (!replay->finished)
+            {
+                printf("Replay finished after %u frames\n", replay->frameIndex);
+            }
+            replay->finished = 1;
+            return 0;
+        }
+        
+        seekReplay(replay, 0);
+        if (!peekRecordingFrame(&replay->reader, &frameHeader, &data))
+        {
+            return 0;
+        }
+    }
+    
+    u64 recordedTimeUs = frameHeader.timestampUs;
+    if (replay->reader.isLegacy)
+    {
+        recordedTimeUs = (u64)replay->frameIndex * REPLAY_LEGACY_FRAME_INTERVAL_US;
+    }
+    
+    if (!replay->clockStarted)
+    {
+        replay->clockStarted = 1;
+        replay->clockStartUs = getMonotonicTimeInUs();
+        replay->recordingStartUs = recordedTimeUs;
+    }
+    
+    // NOTE(jan): frames are handed out at clockStart + recorded time /
+    // speed. A reader that falls behind gets the frames late, none are
+    // skipped, so every recorded frame goes through the pipeline.
+    u64 replayTimeUs = replay->clockStartUs;
+    if (replay->speed > 0.0f)
+    {
+        replayTimeUs += (u64)((i64)(recordedTimeUs - replay->recordingStartUs) /
+                              replay->speed);
+        
+        u64 now = getMonotonicTimeInUs();
+        if (replayTimeUs > now)
+        {
+            usleep(replayTimeUs - now);
+        }
+    }
+    else
+    {
+        replayTimeUs = getMonotonicTimeInUs();
+    }
+    
+    Frame* frame = &replay->frame;
+    if (frameHeader.encoding == RecordingEncoding_Raw)
+    {
+        // NOTE(jan): the mapping is read only, nothing downstream writes
+        // into frames it gets from readFrame
+        if (frameHeader.encodedSize < (u32)(frameHeader.width * frameHeader.height))
+        {
+            return 0;
+        }
+        
+        frame->memory = data;
+        frame->width = frameHeader.width;
+        frame->height = frameHeader.height;
+        frame->pitch = frameHeader.width;
+        frame->size = frameHeader.width * frameHeader.height;
+        frame->originX = frameHeader.originX;
+        frame->originY = frameHeader.originY;
+        frame->sequence = frameHeader.sequence;
+    }
+    else
+    {
+        frame->memory = replay->decodeMemory;
+        frame->pitch = replay->reader.header.width;
+        frame->size = replay->reader.header.width * replay->reader.header.height;
+        if (!decodeRecordingFrame(&frameHeader, data, frame))
+        {
+            return 0;
+        }
+    }
+    
+    skipRecordingFrame(&replay->reader, &frameHeader, data);
+    
+    // NOTE(jan): the recorded timestamps are from another run of the
+    // clock, the beholder needs them on its current one
+    frame->timestampUs = replayTimeUs;
+    if (replay->reader.isLegacy)
+    {
+        frame->sequence = replay->frameIndex;
+    }
+    
+    replay->frameIndex++;
+    *outputFrame = frame;
+    
+    return 1;
+}
+
+static void stopReplay(ReplayState* replay)
+{
+    unmapFile(&replay->file);
+}
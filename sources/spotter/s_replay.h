@@ -0,0 +1,31 @@
+#ifndef S_REPLAY_H
+
+// NOTE(jan): old recordings have no timestamps, they are played at the
+// default capture rate
+#define REPLAY_LEGACY_FRAME_INTERVAL_US (1000000 / CAPTURE_DEFAULT_FPS)
+
+// NOTE(jan): plays a recording back as if it came from the camera. The
+// file is mapped, raw frames are handed out straight from the mapping,
+// encoded ones are decoded into frame. Frames are handed out at the pace
+// they were recorded at, scaled by speed.
+struct ReplayState
+{
+    MappedFile file;
+    RecordingReader reader;
+    Frame frame;
+    u8* decodeMemory;
+    
+    r32 speed; // 0 plays as fast as frames are read
+    bool32 loop;
+    bool32 finished;
+    
+    // NOTE(jan): replay time is anchored at the first frame after a start
+    // or a seek
+    bool32 clockStarted;
+    u64 clockStartUs;
+    u64 recordingStartUs;
+    u32 frameIndex;
+};
+
+#define S_REPLAY_H
+#endif
@@ -12,6 +12,9 @@ static void initApplication(ApplicationState* state,
     state->windowHeight = windowHeight;
     state->ip = ip;
     state->binarizationThreshold = 180;
+    state->adaptiveThreshold = {};
+    state->thresholdCorrectionFrames = 0;
+    state->backgroundLevel = 0;
     
     state->grayscaleFrame = initializeFrame(arena,
                                             windowWidth, windowHeight,
@@ -19,6 +22,33 @@ static void initApplication(ApplicationState* state,
     state->binarizedFrame = initializeFrame(arena,
                                             windowWidth, windowHeight,
                                             1);
+    initRayLookupTable(arena,
+                       &state->rayLookupTable,
+                       windowWidth,
+                       windowHeight);
+    
+    state->markerPrediction = {};
+    state->markerPredictionAge = 0;
+    state->roiTileColumnCount = (windowWidth + EXTRACTION_TILE_SIZE - 1) / EXTRACTION_TILE_SIZE;
+    state->roiTileRowCount = (windowHeight + EXTRACTION_TILE_SIZE - 1) / EXTRACTION_TILE_SIZE;
+    state->roiTileMask = (u8*)pushSize(arena,
+                                       state->roiTileColumnCount *
+                                       state->roiTileRowCount);
+    state->framesSinceFullScan = 0;
+    
+    i32 tileCount = state->roiTileColumnCount * state->roiTileRowCount;
+    state->staticTileMask = (u8*)pushSize(arena, tileCount);
+    memset(state->staticTileMask, 0, tileCount);
+    state->staticTileHitCounts = (u16*)pushSize(arena, tileCount * sizeof(u16));
+    state->hasStaticMask = 0;
+    state->learningStaticMask = 0;
+    state->staticMaskFrameCount = 0;
+    
+    state->cropX = 0;
+    state->cropY = 0;
+    state->cropWidth = windowWidth;
+    state->cropHeight = windowHeight;
+    
     state->calibration = {};
     if (calibration)
     {
@@ -28,8 +58,8 @@ static void initApplication(ApplicationState* state,
     {
         state->calibration.fx = 468.9f;
         state->calibration.fy = 468.9f;
-        state->calibration.cx = CAPTURE_FRAME_WIDTH / 2;
-        state->calibration.cy = CAPTURE_FRAME_HEIGHT / 2;
+        state->calibration.cx = windowWidth / 2;
+        state->calibration.cy = windowHeight / 2;
     }
 }
 
@@ -41,3 +71,369 @@ static void writeToFrame(void* context, void* data, int size)
            size);
     frame->size += size;
 }
+
+// NOTE(jan): bounding rectangle of the tracking volume's corners in the
+// image, aligned to extraction tiles. The projection ignores the lens
+// distortion, the margin has to cover that. If a corner is behind the
+// camera the projection of the volume has no bounds, and a rectangle that
+// would save next to nothing isn't worth a hardware crop either; both
+// give the full frame.
+static void updateCaptureCropRect(ApplicationState* state)
+{
+    i32 frameWidth = (i32)state->windowWidth;
+    i32 frameHeight = (i32)state->windowHeight;
+    
+    state->cropX = 0;
+    state->cropY = 0;
+    state->cropWidth = frameWidth;
+    state->cropHeight = frameHeight;
+    
+    if (!state->hasTrackingVolume ||
+        state->status != ApplicationStatus_Detecting)
+    {
+        return;
+    }
+    
+    V2 imageMin = {};
+    V2 imageMax = {};
+    for (i32 cornerIndex = 0; cornerIndex < 8; cornerIndex++)
+    {
+        V3 corner = v3((cornerIndex & 1) ? state->trackingVolumeMax.x : state->trackingVolumeMin.x,
+                       (cornerIndex & 2) ? state->trackingVolumeMax.y : state->trackingVolumeMin.y,
+                       (cornerIndex & 4) ? state->trackingVolumeMax.z : state->trackingVolumeMin.z);
+        
+        V4 cameraPoint = multM4x4V4(state->cTw.fwd, v4(corner, 1.0f));
+        if (cameraPoint.z <= 0.001f)
+        {
+            return;
+        }
+        
+        V2 imagePoint = projectWorldToCamera(&corner,
+                                             &state->cTw.fwd,
+                                             &state->calibration);
+        if (cornerIndex == 0)
+        {
+            imageMin = imagePoint;
+            imageMax = imagePoint;
+        }
+        else
+        {
+            imageMin.x = fminf(imageMin.x, imagePoint.x);
+            imageMin.y = fminf(imageMin.y, imagePoint.y);
+            imageMax.x = fmaxf(imageMax.x, imagePoint.x);
+            imageMax.y = fmaxf(imageMax.y, imagePoint.y);
+        }
+    }
+    
+    // NOTE(jan): clamped before the conversion, corners close to the
+    // camera plane project far outside of the frame
+    r32 minX = fminf(fmaxf(imageMin.x - CAPTURE_CROP_MARGIN_PIXELS, 0.0f), (r32)frameWidth);
+    r32 minY = fminf(fmaxf(imageMin.y - CAPTURE_CROP_MARGIN_PIXELS, 0.0f), (r32)frameHeight);
+    r32 maxX = fminf(fmaxf(imageMax.x + CAPTURE_CROP_MARGIN_PIXELS, 0.0f), (r32)frameWidth);
+    r32 maxY = fminf(fmaxf(imageMax.y + CAPTURE_CROP_MARGIN_PIXELS, 0.0f), (r32)frameHeight);
+    
+    i32 left = (i32)(minX / EXTRACTION_TILE_SIZE) * EXTRACTION_TILE_SIZE;
+    i32 top = (i32)(minY / EXTRACTION_TILE_SIZE) * EXTRACTION_TILE_SIZE;
+    i32 right = min((i32)ceilf(maxX / EXTRACTION_TILE_SIZE) * EXTRACTION_TILE_SIZE,
+                    frameWidth);
+    i32 bottom = min((i32)ceilf(maxY / EXTRACTION_TILE_SIZE) * EXTRACTION_TILE_SIZE,
+                     frameHeight);
+    
+    if (left >= right || top >= bottom)
+    {
+        printf("Tracking volume is not in view\n");
+        return;
+    }
+    
+    r32 areaFraction = ((r32)((right - left) * (bottom - top)) /
+                        (r32)(frameWidth * frameHeight));
+    if (areaFraction > CAPTURE_CROP_MAX_AREA_FRACTION)
+    {
+        return;
+    }
+    
+    state->cropX = left;
+    state->cropY = top;
+    state->cropWidth = right - left;
+    state->cropHeight = bottom - top;
+}
+
+// NOTE(jan): marks the tiles around every predicted marker in front of the
+// camera. The projection ignores the lens distortion, the margin has to
+// cover that. Returns the number of markers that should be in the frame.
+// The mask is laid out for the frame, which may be cropped, with the
+// row length of a full frame.
+static i32 buildMarkerRoiTileMask(ApplicationState* state,
+                                  Frame* frame)
+{
+    i32 result = 0;
+    
+    memset(state->roiTileMask,
+           0,
+           state->roiTileColumnCount * state->roiTileRowCount);
+    
+    i32 tileColumnCount = (frame->width + EXTRACTION_TILE_SIZE - 1) / EXTRACTION_TILE_SIZE;
+    i32 tileRowCount = (frame->height + EXTRACTION_TILE_SIZE - 1) / EXTRACTION_TILE_SIZE;
+    
+    MarkerPrediction* prediction = &state->markerPrediction;
+    for (u32 markerIndex = 0;
+         markerIndex < prediction->markerCount;
+         markerIndex++)
+    {
+        V3* position = &prediction->positions[markerIndex];
+        
+        V4 cameraPoint = multM4x4V4(state->cTw.fwd, v4(*position, 1.0f));
+        if (cameraPoint.z <= 0.001f)
+        {
+            continue;
+        }
+        
+        V2 imagePoint = projectWorldToCamera(position,
+                                             &state->cTw.fwd,
+                                             &state->calibration);
+        r32 radius = prediction->radius * (r32)state->calibration.fx / cameraPoint.z;
+        radius += ROI_MARGIN_PIXELS;
+        
+        imagePoint.x -= frame->originX;
+        imagePoint.y -= frame->originY;
+        
+        i32 minTileX = (i32)floorf((imagePoint.x - radius) / EXTRACTION_TILE_SIZE);
+        i32 maxTileX = (i32)floorf((imagePoint.x + radius) / EXTRACTION_TILE_SIZE);
+        i32 minTileY = (i32)floorf((imagePoint.y - radius) / EXTRACTION_TILE_SIZE);
+        i32 maxTileY = (i32)floorf((imagePoint.y + radius) / EXTRACTION_TILE_SIZE);
+        
+        if (maxTileX < 0 || minTileX >= tileColumnCount ||
+            maxTileY < 0 || minTileY >= tileRowCount)
+        {
+            continue;
+        }
+        
+        minTileX = max(minTileX, 0);
+        minTileY = max(minTileY, 0);
+        maxTileX = min(maxTileX, tileColumnCount - 1);
+        maxTileY = min(maxTileY, tileRowCount - 1);
+        
+        for (i32 tileY = minTileY; tileY <= maxTileY; tileY++)
+        {
+            u8* tile = state->roiTileMask + tileY * state->roiTileColumnCount;
+            for (i32 tileX = minTileX; tileX <= maxTileX; tileX++)
+            {
+                tile[tileX] = 1;
+            }
+        }
+        
+        result++;
+    }
+    
+    return result;
+}
+
+static void startStaticMaskLearning(ApplicationState* state)
+{
+    memset(state->staticTileHitCounts,
+           0,
+           state->roiTileColumnCount * state->roiTileRowCount * sizeof(u16));
+    state->staticMaskFrameCount = 0;
+    state->learningStaticMask = 1;
+    
+    printf("Learning static mask over %i frames\n", STATIC_MASK_LEARNING_FRAMES);
+}
+
+// NOTE(jan): counts for every sensor tile the frames it was covered by a
+// blob in. Markers move through the scene while reflections and hot
+// pixels stay put, so only the latter are hit in nearly every frame.
+// Blobs too big to be markers are dropped by the extraction anyway and
+// don't need to be masked.
+static void learnStaticMask(ApplicationState* state,
+                            MarkerBlob* blobs,
+                            i32 blobCount,
+                            Frame* frame)
+{
+    i32 tileCount = state->roiTileColumnCount * state->roiTileRowCount;
+    
+    // NOTE(jan): the mask isn't used while learning, it keeps the tiles
+    // hit in this frame, so a tile covered by two blobs counts once
+    u8* hitTiles = state->staticTileMask;
+    memset(hitTiles, 0, tileCount);
+    
+    for (i32 blobIndex = 0; blobIndex < blobCount; blobIndex++)
+    {
+        MarkerBlob* blob = &blobs[blobIndex];
+        i32 minTileX = ((i32)blob->min.x + frame->originX) / EXTRACTION_TILE_SIZE;
+        i32 minTileY = ((i32)blob->min.y + frame->originY) / EXTRACTION_TILE_SIZE;
+        i32 maxTileX = ((i32)blob->max.x + frame->originX) / EXTRACTION_TILE_SIZE;
+        i32 maxTileY = ((i32)blob->max.y + frame->originY) / EXTRACTION_TILE_SIZE;
+        maxTileX = min(maxTileX, state->roiTileColumnCount - 1);
+        maxTileY = min(maxTileY, state->roiTileRowCount - 1);
+        
+        for (i32 tileY = minTileY; tileY <= maxTileY; tileY++)
+        {
+            u8* tile = hitTiles + tileY * state->roiTileColumnCount;
+            for (i32 tileX = minTileX; tileX <= maxTileX; tileX++)
+            {
+                tile[tileX] = 1;
+            }
+        }
+    }
+    
+    for (i32 tileIndex = 0; tileIndex < tileCount; tileIndex++)
+    {
+        state->staticTileHitCounts[tileIndex] += hitTiles[tileIndex];
+    }
+    state->staticMaskFrameCount++;
+    
+    if (state->staticMaskFrameCount >= STATIC_MASK_LEARNING_FRAMES)
+    {
+        u16 minHitCount = (u16)(STATIC_MASK_MIN_HIT_FRACTION * state->staticMaskFrameCount);
+        i32 maskedTileCount = 0;
+        for (i32 tileIndex = 0; tileIndex < tileCount; tileIndex++)
+        {
+            state->staticTileMask[tileIndex] =
+                state->staticTileHitCounts[tileIndex] >= minHitCount;
+            maskedTileCount += state->staticTileMask[tileIndex];
+        }
+        
+        state->hasStaticMask = maskedTileCount > 0;
+        state->learningStaticMask = 0;
+        
+        printf("Static mask learned, %i of %i tiles masked\n",
+               maskedTileCount,
+               tileCount);
+    }
+}
+
+// NOTE(jan): clears the tiles of the frame that touch a masked sensor
+// tile in the tile mask handed to the extraction. Without a region of
+// interest the mask is filled first, so everything else is looked at.
+// Crops are tile aligned, then every frame tile is exactly one sensor
+// tile.
+static void maskStaticTiles(ApplicationState* state,
+                            Frame* frame,
+                            bool32 keepRegionOfInterest)
+{
+    i32 tileColumnCount = (frame->width + EXTRACTION_TILE_SIZE - 1) / EXTRACTION_TILE_SIZE;
+    i32 tileRowCount = (frame->height + EXTRACTION_TILE_SIZE - 1) / EXTRACTION_TILE_SIZE;
+    
+    for (i32 tileY = 0; tileY < tileRowCount; tileY++)
+    {
+        u8* tile = state->roiTileMask + tileY * state->roiTileColumnCount;
+        
+        i32 startY = frame->originY + tileY * EXTRACTION_TILE_SIZE;
+        i32 endY = frame->originY + min((tileY + 1) * EXTRACTION_TILE_SIZE, frame->height);
+        i32 minSensorTileY = startY / EXTRACTION_TILE_SIZE;
+        i32 maxSensorTileY = min((endY - 1) / EXTRACTION_TILE_SIZE,
+                                 state->roiTileRowCount - 1);
+        
+        for (i32 tileX = 0; tileX < tileColumnCount; tileX++)
+        {
+            if (!keepRegionOfInterest)
+            {
+                tile[tileX] = 1;
+            }
+            
+            i32 startX = frame->originX + tileX * EXTRACTION_TILE_SIZE;
+            i32 endX = frame->originX + min((tileX + 1) * EXTRACTION_TILE_SIZE, frame->width);
+            i32 minSensorTileX = startX / EXTRACTION_TILE_SIZE;
+            i32 maxSensorTileX = min((endX - 1) / EXTRACTION_TILE_SIZE,
+                                     state->roiTileColumnCount - 1);
+            
+            for (i32 sensorTileY = minSensorTileY;
+                 sensorTileY <= maxSensorTileY;
+                 sensorTileY++)
+            {
+                u8* sensorTile = state->staticTileMask +
+                    sensorTileY * state->roiTileColumnCount;
+                for (i32 sensorTileX = minSensorTileX;
+                     sensorTileX <= maxSensorTileX;
+                     sensorTileX++)
+                {
+                    if (sensorTile[sensorTileX])
+                    {
+                        tile[tileX] = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// NOTE(jan): the threshold is kept ADAPTIVE_THRESHOLD_NOISE_MARGIN above
+// the background, the level 95% of the sampled pixels are at or below.
+// Only every 64th pixel is sampled, the few samples that hit a marker
+// are far above that percentile and don't move it. Above that, the
+// threshold is stepped towards the target marker count, but only after
+// the count was off in the same direction for a few frames, so a marker
+// that is hidden for a moment or a single reflection doesn't move it.
+// Without histogram samples (e.g. OpenCV extraction) only the
+// configured bounds are kept.
+static void adaptBinarizationThreshold(ApplicationState* state,
+                                       u32* histogram,
+                                       u32 histogramSampleCount,
+                                       i32 blobCount)
+{
+    AdaptiveThresholdConfig* config = &state->adaptiveThreshold;
+    if (!config->targetMarkerCount)
+    {
+        return;
+    }
+    
+    i32 lowerBound = config->minThreshold;
+    i32 upperBound = config->maxThreshold;
+    if (histogramSampleCount)
+    {
+        u32 backgroundSampleCount =
+            (u32)(histogramSampleCount * ADAPTIVE_THRESHOLD_BACKGROUND_FRACTION);
+        u32 sampleCount = 0;
+        i32 level = 0;
+        for (; level < 255; level++)
+        {
+            sampleCount += histogram[level];
+            if (sampleCount >= backgroundSampleCount)
+            {
+                break;
+            }
+        }
+        state->backgroundLevel = (u8)level;
+        
+        lowerBound = max(lowerBound, level + ADAPTIVE_THRESHOLD_NOISE_MARGIN);
+    }
+    lowerBound = min(lowerBound, upperBound);
+    
+    i32 countError = blobCount - (i32)config->targetMarkerCount;
+    if (countError > ADAPTIVE_THRESHOLD_COUNT_TOLERANCE)
+    {
+        state->thresholdCorrectionFrames =
+            max(state->thresholdCorrectionFrames, 0) + 1;
+    }
+    else if (countError < -ADAPTIVE_THRESHOLD_COUNT_TOLERANCE)
+    {
+        state->thresholdCorrectionFrames =
+            min(state->thresholdCorrectionFrames, 0) - 1;
+    }
+    else
+    {
+        state->thresholdCorrectionFrames = 0;
+    }
+    
+    i32 threshold = state->binarizationThreshold;
+    if (state->thresholdCorrectionFrames >= ADAPTIVE_THRESHOLD_SETTLE_FRAMES)
+    {
+        threshold += ADAPTIVE_THRESHOLD_STEP;
+        state->thresholdCorrectionFrames = 0;
+    }
+    else if (state->thresholdCorrectionFrames <= -ADAPTIVE_THRESHOLD_SETTLE_FRAMES)
+    {
+        threshold -= ADAPTIVE_THRESHOLD_STEP;
+        state->thresholdCorrectionFrames = 0;
+    }
+    
+    // NOTE(jan): a threshold below the lower bound climbs by
+    // ADAPTIVE_THRESHOLD_STEP per frame, a single bright frame doesn't
+    // throw it far off. Once there, it stays above the bound.
+    threshold = max(threshold,
+                    min(state->binarizationThreshold + ADAPTIVE_THRESHOLD_STEP,
+                        lowerBound));
+    threshold = min(threshold, upperBound);
+    
+    state->binarizationThreshold = (u8)threshold;
+}
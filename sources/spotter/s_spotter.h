@@ -22,18 +22,51 @@ struct ApplicationState
     Frame binarizedFrame;
     u8 binarizationThreshold;
     
+    // NOTE(jan): the threshold follows the marker count, see
+    // adaptBinarizationThreshold
+    AdaptiveThresholdConfig adaptiveThreshold;
+    i32 thresholdCorrectionFrames; // > 0 too many blobs, < 0 too few
+    u8 backgroundLevel;
+    
     u32 windowWidth;
     u32 windowHeight;
     
     M4x4inv cTw;
     Calibration calibration;
     V3 cameraOrigin = {};
-    
-    M4x4inv poseEstimations[POSE_ESTIMATION_COUNT];
-    i32 poseEstimationIndex = 0;
-    u64 timeOfLastCapture;
+    RayLookupTable rayLookupTable;
     
     bool32 poseLoadedFromFile = 0;
+    
+    // NOTE(jan): regions of interest from the beholder's marker prediction.
+    // The tile mask is handed to the extraction, with the static mask
+    // applied it is also used without a prediction.
+    MarkerPrediction markerPrediction;
+    u32 markerPredictionAge;
+    u8* roiTileMask;
+    i32 roiTileColumnCount;
+    i32 roiTileRowCount;
+    i32 framesSinceFullScan;
+    
+    // NOTE(jan): tiles of the full sensor frame that were bright in
+    // nearly every frame of the learning window, reflections of the room
+    // and hot pixels. They are never looked at again.
+    u8* staticTileMask;
+    u16* staticTileHitCounts;
+    bool32 hasStaticMask;
+    bool32 learningStaticMask;
+    i32 staticMaskFrameCount;
+    
+    // NOTE(jan): box in world space (cm) the markers stay in. Only the
+    // part of the image it projects into is captured.
+    bool32 hasTrackingVolume;
+    V3 trackingVolumeMin;
+    V3 trackingVolumeMax;
+    bool32 captureCropOutdated;
+    i32 cropX;
+    i32 cropY;
+    i32 cropWidth;
+    i32 cropHeight;
 };
 
 #define SPOTTER_H
@@ -1,8 +1,285 @@
 #include "../include/transmission.h"
+#include "s_transmission.h"
 
 inline static void receiveMessages(MemoryArena* arena, 
                                    TransmissionState* receiverState,
                                    TransmissionState* senderState)
 {
     
-}
\ No newline at end of file
+}
+
+static SendQueueClass getSendQueueClass(MessageType type)
+{
+    SendQueueClass result = SendQueueClass_Control;
+    
+    switch (type)
+    {
+        case MessageType_Payload: {
+            result = SendQueueClass_Rays;
+        } break;
+        
+        case MessageType_DebugFrame: {
+            result = SendQueueClass_Frames;
+        } break;
+        
+        default: {
+            result = SendQueueClass_Control;
+        } break;
+    }
+    
+    return result;
+}
+
+static void initSendQueueChannel(MemoryArena* arena,
+                                 SendQueueChannel* channel,
+                                 u32 slotCount,
+                                 u32 slotSize,
+                                 bool32 latestWins)
+{
+    assert(slotCount <= SEND_QUEUE_MAX_SLOT_COUNT);
+    
+    *channel = {};
+    channel->slotCount = slotCount;
+    channel->slotSize = slotSize;
+    channel->latestWins = latestWins;
+    
+    for (u32 slotIndex = 0;
+         slotIndex < slotCount;
+         slotIndex++)
+    {
+        channel->slots[slotIndex].memory = (u8*)pushSize(arena, slotSize);
+    }
+}
+
+static void sendQueueWorker(SendQueue* queue)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    
+    for (;;)
+    {
+        SendQueueChannel* channel = 0;
+        for (i32 classIndex = 0;
+             classIndex < SendQueueClass_Count;
+             classIndex++)
+        {
+            if (queue->channels[classIndex].pendingCount)
+            {
+                channel = &queue->channels[classIndex];
+                break;
+            }
+        }
+        
+        if (!channel)
+        {
+            if (!queue->running)
+            {
+                break;
+            }
+            
+            queue->wakeSender.wait(lock);
+            continue;
+        }
+        
+        SendQueueSlot* slot = &channel->slots[channel->readIndex];
+        channel->sending = 1;
+        lock.unlock();
+        
+        // NOTE(jan): the socket has a send timeout, so a missing beholder
+        // can't keep us from shutting down. While running we keep retrying,
+        // messages that never get out on shutdown are counted as dropped.
+        bool32 sent = 0;
+        for (;;)
+        {
+            i32 bytesSent = zmq_send(queue->transmissionState->socket,
+                                     slot->memory,
+                                     slot->size,
+                                     0);
+            if (bytesSent != -1)
+            {
+                sent = 1;
+                break;
+            }
+            
+            if (zmq_errno() != EAGAIN)
+            {
+                printf("Error when sending message\n");
+                break;
+            }
+            
+            lock.lock();
+            bool32 running = queue->running;
+            lock.unlock();
+            
+            if (!running)
+            {
+                break;
+            }
+        }
+        
+        lock.lock();
+        channel->sending = 0;
+        channel->readIndex = (channel->readIndex + 1) % channel->slotCount;
+        channel->pendingCount--;
+        if (sent)
+        {
+            channel->sentCount++;
+        }
+        else
+        {
+            channel->droppedCount++;
+        }
+        queue->slotFreed.notify_all();
+    }
+}
+
+static void startSendQueue(MemoryArena* arena,
+                           SendQueue* queue,
+                           TransmissionState* transmissionState,
+                           u32 maxFrameSize)
+{
+    queue->transmissionState = transmissionState;
+    
+    initSendQueueChannel(arena,
+                         &queue->channels[SendQueueClass_Control],
+                         SEND_QUEUE_CONTROL_SLOT_COUNT,
+                         SEND_QUEUE_CONTROL_SLOT_SIZE,
+                         0);
+    // NOTE(jan): latest-wins channels need one slot for the message
+    // in flight and one for the newest pending message
+    initSendQueueChannel(arena,
+                         &queue->channels[SendQueueClass_Rays],
+                         2,
+                         SEND_QUEUE_RAYS_SLOT_SIZE,
+                         1);
+    initSendQueueChannel(arena,
+                         &queue->channels[SendQueueClass_Frames],
+                         2,
+                         sizeof(MessageHeader) + maxFrameSize,
+                         1);
+    
+    i32 sendTimeout = SEND_QUEUE_SEND_TIMEOUT_MS;
+    zmq_setsockopt(transmissionState->socket,
+                   ZMQ_SNDTIMEO,
+                   &sendTimeout,
+                   sizeof(sendTimeout));
+    
+    queue->running = 1;
+    queue->sender = std::thread(sendQueueWorker, queue);
+}
+
+// NOTE(jan): sends everything still queued up and joins the sender thread
+static void stopSendQueue(SendQueue* queue)
+{
+    queue->mutex.lock();
+    queue->running = 0;
+    queue->mutex.unlock();
+    queue->wakeSender.notify_one();
+    
+    if (queue->sender.joinable())
+    {
+        queue->sender.join();
+    }
+}
+
+// NOTE(jan): never blocks on the network. Only blocks if a never-drop
+// queue is full, until the sender thread has freed up a slot.
+static void queueMessage(SendQueue* queue,
+                         MessageType type,
+                         void* payload,
+                         u32 payloadSize,
+                         u8 spotterId)
+{
+    SendQueueChannel* channel = &queue->channels[getSendQueueClass(type)];
+    u32 messageSize = sizeof(MessageHeader) + payloadSize;
+    
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    
+    channel->queuedCount++;
+    
+    if (messageSize > channel->slotSize)
+    {
+        printf("Message of type %i too big for send queue (%u bytes)\n",
+               type, messageSize);
+        channel->droppedCount++;
+        return;
+    }
+    
+    if (channel->latestWins)
+    {
+        // NOTE(jan): drop everything the sender thread hasn't picked up yet
+        u32 droppedCount = channel->pendingCount - channel->sending;
+        channel->droppedCount += droppedCount;
+        channel->pendingCount -= droppedCount;
+    }
+    else
+    {
+        while (channel->pendingCount >= channel->slotCount)
+        {
+            queue->slotFreed.wait(lock);
+        }
+    }
+    
+    assert(channel->pendingCount < channel->slotCount);
+    
+    u32 writeIndex = 
+        (channel->readIndex + channel->pendingCount) % channel->slotCount;
+    SendQueueSlot* slot = &channel->slots[writeIndex];
+    
+    MessageHeader* header = (MessageHeader*)slot->memory;
+    *header = {};
+    header->type = type;
+    header->spotterID = spotterId;
+    header->payloadSize = payloadSize;
+    
+    if (payloadSize)
+    {
+        memcpy(slot->memory + sizeof(MessageHeader), payload, payloadSize);
+    }
+    
+    slot->size = messageSize;
+    channel->pendingCount++;
+    
+    lock.unlock();
+    queue->wakeSender.notify_one();
+}
+
+static SendQueueStats getSendQueueStats(SendQueue* queue)
+{
+    SendQueueStats result = {};
+    
+    queue->mutex.lock();
+    for (i32 classIndex = 0;
+         classIndex < SendQueueClass_Count;
+         classIndex++)
+    {
+        SendQueueChannel* channel = &queue->channels[classIndex];
+        result.queued[classIndex] = channel->queuedCount;
+        result.sent[classIndex] = channel->sentCount;
+        result.dropped[classIndex] = channel->droppedCount;
+        result.pending[classIndex] = channel->pendingCount;
+    }
+    queue->mutex.unlock();
+    
+    return result;
+}
+
+static void printSendQueueStats(SendQueueStats* stats)
+{
+    const char* classNames[SendQueueClass_Count] = {
+        "control", "rays", "frames"
+    };
+    
+    printf("send queue:");
+    for (i32 classIndex = 0;
+         classIndex < SendQueueClass_Count;
+         classIndex++)
+    {
+        printf(" %s %" PRIu64 "/%" PRIu64 " sent, %" PRIu64 " dropped, %u pending;",
+               classNames[classIndex],
+               stats->sent[classIndex],
+               stats->queued[classIndex],
+               stats->dropped[classIndex],
+               stats->pending[classIndex]);
+    }
+    printf("\n");
+}
@@ -0,0 +1,64 @@
+#ifndef S_TRANSMISSION_H
+
+#define SEND_QUEUE_MAX_SLOT_COUNT 16
+#define SEND_QUEUE_CONTROL_SLOT_COUNT 16
+#define SEND_QUEUE_CONTROL_SLOT_SIZE kilobytes(1)
+#define SEND_QUEUE_RAYS_SLOT_SIZE kilobytes(16)
+#define SEND_QUEUE_SEND_TIMEOUT_MS 100
+
+// NOTE(jan): every message class gets its own bounded queue. Latest-wins
+// classes only ever keep the newest message that has not been handed to 
+// zmq yet, all other classes never drop and make the producer wait instead
+enum SendQueueClass
+{
+    SendQueueClass_Control, // handshake, camera poses
+    SendQueueClass_Rays,    // ray payloads, latest wins
+    SendQueueClass_Frames,  // debug frames, latest wins
+    SendQueueClass_Count
+};
+
+struct SendQueueSlot
+{
+    u8* memory;
+    u32 size;
+};
+
+struct SendQueueChannel
+{
+    SendQueueSlot slots[SEND_QUEUE_MAX_SLOT_COUNT];
+    u32 slotCount;
+    u32 slotSize;
+    bool32 latestWins;
+    
+    u32 readIndex;
+    u32 pendingCount;
+    // NOTE(jan): set while the sender thread owns the slot at readIndex
+    bool32 sending;
+    
+    u64 queuedCount;
+    u64 sentCount;
+    u64 droppedCount;
+};
+
+struct SendQueueStats
+{
+    u64 queued[SendQueueClass_Count];
+    u64 sent[SendQueueClass_Count];
+    u64 dropped[SendQueueClass_Count];
+    u32 pending[SendQueueClass_Count];
+};
+
+struct SendQueue
+{
+    TransmissionState* transmissionState;
+    SendQueueChannel channels[SendQueueClass_Count];
+    
+    std::mutex mutex;
+    std::condition_variable wakeSender;
+    std::condition_variable slotFreed;
+    std::thread sender;
+    bool32 running;
+};
+
+#define S_TRANSMISSION_H
+#endif